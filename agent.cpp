@@ -2,8 +2,30 @@
 #include <algorithm>
 #include <numeric>
 #include <fstream>
+#include <chrono>
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <array>
+#include <functional>
+#include <deque>
+#include <tuple>
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "agent.hpp"
+#include "metrics.hpp"
+#include "infections.hpp"
+#include "history.hpp"
 
 /*
  * Author: Zilu Tian 
@@ -51,6 +73,10 @@ class LocationSummary : public Log{
       log.find(state)->second += 1; 
     }
 
+    void add(enum SEIHCRD state, PopulationSize n){
+      log.find(state)->second += n; 
+    }
+
     void publish(){
       reinitialize(); 
     }    
@@ -59,6 +85,12 @@ class LocationSummary : public Log{
       return log.find(state)->second; 
     }
 
+    // count at the last publish, 0 before the first one 
+    PopulationSize last(enum SEIHCRD state){
+      auto it = last_summary.find(state); 
+      return it == last_summary.end() ? 0 : it->second; 
+    }
+
     Summary getSummary(){
       return last_summary; 
     }
@@ -88,85 +120,182 @@ class SEIHCRD_Transitions {
       record->set(health_status, ts); 
     }
 
-    void S2E(timestamp ts){
-      health_status = EXPOSED; 
+    // move to `to`, the location follows from the new state (see locationAfter) 
+    void transit(enum SEIHCRD to, timestamp ts){
+      health_status = to; 
+      location = locationAfter(to, location); 
       record -> set(health_status, ts); 
     }
 
-    void E2I(timestamp ts){
-      health_status = INFECTIOUS;
-      record -> set(health_status, ts); 
-    }
+    void S2E(timestamp ts){ transit(EXPOSED, ts); }
+    void E2I(timestamp ts){ transit(INFECTIOUS, ts); }
+    void I2R(timestamp ts){ transit(RECOVERED, ts); }
+    void I2H(timestamp ts){ transit(HOSPITALIZED, ts); }
+    void I2D(timestamp ts){ transit(DECEASED, ts); }
+    void H2C(timestamp ts){ transit(CRITICAL, ts); }
+    void H2R(timestamp ts){ transit(RECOVERED, ts); }
+    void H2D(timestamp ts){ transit(DECEASED, ts); }
+    void C2D(timestamp ts){ transit(DECEASED, ts); }
+    void C2R(timestamp ts){ transit(RECOVERED, ts); }
+}; 
 
-    void I2R(timestamp ts){
-      health_status = RECOVERED;
-      location = HOME; 
-      record -> set(health_status, ts); 
-    } 
+/*
+  Disease model of a single agent, shared by Person and CompactAgent. 
+  Agent provides status(), isSymptomatic(), ageGroup(), enteredAt(ts) (when the 
+  current status was entered) and transit(to, ts). 
 
-    void I2H(timestamp ts){
-      health_status = HOSPITALIZED;
-      location = HOSPITAL; 
-      record -> set(health_status, ts); 
+  asymptomatic and infectious -> gamma 
+  asymptomatic and exposed -> 0 
+  sympotomatic and infectious -> 1.5*gamma 
+  symptomatic and exposed and greater than latent period -> gamma
+  symptomatic and exposed and less than latent period -> 0 
+*/
+template <class Agent>
+double infectiousness(Agent& agent, enum SEIHCRD status, timestamp ts, mt19937& gen){
+  if (status == SUSCEPTIBLE || status == RECOVERED || status == DECEASED) {
+    return 0; 
+  }
+
+  double rand_gamma = randGamma(gen);
+  if (status == EXPOSED){
+    if (agent.isSymptomatic() && (agent.enteredAt(ts) > SYMPTOMATIC_LATENT_PERIOD)){
+      return rand_gamma; 
     }
+    return 0; 
+  }
 
-    void I2D(timestamp ts){
-      health_status = DECEASED;
-      location = CEMENTRY; 
-      record -> set(health_status, ts); 
+  if (agent.isSymptomatic()){
+    return SYMPTOMATIC_INFECTIOUSNESS_SCALE * rand_gamma; 
+  } else {
+    return rand_gamma; 
+  }
+}
+
+// `treated`: has held the bed (HOSPITALIZED) or ICU bed (CRITICAL) it needs every tick of 
+// the stay so far, see HospitalSystem 
+// `severity`: scales the chance of hospitalization and of dying without it (vaccination) 
+template <class Agent>
+enum SEIHCRD progress(Agent& agent, timestamp ts, mt19937& gen, bool treated, double severity = 1){
+  bool symptomatic = agent.isSymptomatic(); 
+  int age_group = agent.ageGroup(); 
+  auto timeToTransit = [&agent, ts](timestamp duration){
+    return ts - agent.enteredAt(ts) == duration; 
+  }; 
+
+  switch (agent.status()) {
+    case SUSCEPTIBLE: 
+      break; 
+    case EXPOSED:  
+      if (symptomatic && timeToTransit(INCUBATION_PERIOD)){
+        agent.transit(INFECTIOUS, ts); 
+      } 
+      if (!symptomatic && timeToTransit(ASYMPTOMATIC_LATENT_PERIOD)){
+        agent.transit(INFECTIOUS, ts); 
+      }
+      break; 
+    case INFECTIOUS: 
+      if (!symptomatic && timeToTransit(ASYMPTOMATIC_RECOVER)){
+        if (prob2Bool(gen, rateByAgeGroup(FATALITY, age_group) * severity)){
+          agent.transit(DECEASED, ts); 
+        } else {
+          agent.transit(RECOVERED, ts); 
+        }
+      } 
+      if(symptomatic && timeToTransit(HOSPITALIZATION_DELAY_MEAN)){
+        if (prob2Bool(gen, rateByAgeGroup(HOSPITALIZATION, age_group) * severity)){
+          agent.transit(HOSPITALIZED, ts); 
+        }
+      } 
+      if(symptomatic && timeToTransit(MILD_RECOVER)){
+        agent.transit(RECOVERED, ts); 
+      }
+      break;  
+    case HOSPITALIZED: 
+      assert(DECIDE_CRITICAL < HOSPITAL_DAYS); 
+      if (timeToTransit(DECIDE_CRITICAL)){
+        if (prob2Bool(gen, rateByAgeGroup(ICU, age_group))){
+          agent.transit(CRITICAL, ts); 
+        }
+      } 
+      if (timeToTransit(HOSPITAL_DAYS)){
+        double fatality = rateByAgeGroup(FATALITY, age_group) * (treated ? 1 : UNTREATED_FATALITY_SCALE); 
+        if (prob2Bool(gen, fatality)){
+          agent.transit(DECEASED, ts); 
+        } else {
+          agent.transit(RECOVERED, ts);
+        } 
+      }
+      break; 
+    case CRITICAL:  // roll the die only once 
+      if(timeToTransit(ICU_DAYS)){
+        if (prob2Bool(gen, treated ? CRITICAL_DEATH : CRITICAL_DEATH_WITHOUT_ICU)){
+          agent.transit(DECEASED, ts); 
+        } else {
+          agent.transit(RECOVERED, ts); 
+        }
+      }
+      break; 
+    case RECOVERED:
+    case DECEASED: 
+      break;   
+  }
+  return agent.status(); 
+}
+
+/*
+  Four-byte agent of the compact storage mode of Location, for populations 
+  where a Person and its heap-allocated state do not fit in memory. 
+  bits: 0-2 status, 3-5 location, 6-9 age group, 10 symptomatic, 11 isolate. 
+  `entered` is the tick the current status was entered modulo 2^16, which is 
+  exact as long as no timed status lasts 65536 ticks. 
+*/
+class CompactAgent {
+  public: 
+    uint16_t bits; 
+    uint16_t entered; 
+
+    CompactAgent(){}
+
+    CompactAgent(enum AtLocation loc, enum SEIHCRD health, int age_group, bool symp, bool iso, timestamp ts){
+      bits = health | (loc << 3) | (age_group << 6) | (symp << 10) | (iso << 11); 
+      entered = static_cast<uint16_t>(ts); 
     }
 
-    void H2C(timestamp ts){
-      health_status = CRITICAL;
-      location = HOSPITAL; 
-      record -> set(health_status, ts); 
+    enum SEIHCRD status() const {
+      return static_cast<enum SEIHCRD>(bits & 7); 
     }
 
-    void H2R(timestamp ts){
-      health_status = RECOVERED;
-      location = HOME; 
-      record -> set(health_status, ts); 
+    enum AtLocation atLocation() const {
+      return static_cast<enum AtLocation>((bits >> 3) & 7); 
     }
 
-    void H2D(timestamp ts){
-      health_status = DECEASED;
-      location = CEMENTRY; 
-      record -> set(health_status, ts); 
+    int ageGroup() const {
+      return (bits >> 6) & 15; 
     }
 
-    void C2D(timestamp ts){
-      health_status = DECEASED;
-      location = CEMENTRY; 
-      record -> set(health_status, ts); 
+    bool isSymptomatic() const {
+      return (bits >> 10) & 1; 
     }
 
-    void C2R(timestamp ts){
-      health_status = RECOVERED;
-      location = HOME; 
-      record -> set(health_status, ts); 
+    bool isIsolate() const {
+      return (bits >> 11) & 1; 
     }
-}; 
 
-class Person {
-  private: 
-    // non-critical death 
-    bool isFatal(){
-      return prob2Bool(rateByAge(FATALITY, age)); 
-    }    
-    
-    bool isHospitalized(){
-      return prob2Bool(rateByAge(HOSPITALIZATION, age)); 
+    timestamp enteredAt(timestamp ts) const {
+      return ts - static_cast<uint16_t>(ts - entered); 
     }
 
-    bool isCritical(){
-      return prob2Bool(rateByAge(ICU, age)); 
+    void transit(enum SEIHCRD to, timestamp ts){
+      bits = (bits & ~63) | to | (locationAfter(to, atLocation()) << 3); 
+      entered = static_cast<uint16_t>(ts); 
     }
 
-    // Alternatively, define with approximation 
-    // bool isCritical(){
-    //   return prob2Bool(HOSPITALIZATION_CRITICAL); 
-    // }
+    bool operator==(const CompactAgent& other) const {
+      return bits == other.bits && entered == other.entered; 
+    }
+}; 
 
+class Person {
   public: 
     int age; 
     int latent_period; 
@@ -179,6 +308,7 @@ class Person {
       state = initial_state; 
       age = getAge(age_by_location.find(initial_state->location)->second); 
       symptomatic = prob2Bool(PROB_SYMPTOMATIC); 
+      isolate = false; 
       if (symptomatic){
         latent_period = SYMPTOMATIC_LATENT_PERIOD; 
         isolate = prob2Bool(INFECTIOUS_SELF_ISOLATE_RATIO); 
@@ -191,6 +321,7 @@ class Person {
       state = initial_state; 
       age = a;  
       symptomatic = prob2Bool(PROB_SYMPTOMATIC); 
+      isolate = false; 
       if (symptomatic){
         latent_period = SYMPTOMATIC_LATENT_PERIOD; 
         isolate = prob2Bool(INFECTIOUS_SELF_ISOLATE_RATIO); 
@@ -199,6 +330,40 @@ class Person {
       }
     }
 
+    // restore a previously generated person (see WorldImage) 
+    Person(SEIHCRD_Transitions* initial_state, int a, bool symp, bool iso){
+      state = initial_state; 
+      age = a; 
+      symptomatic = symp; 
+      isolate = iso; 
+      latent_period = symptomatic ? SYMPTOMATIC_LATENT_PERIOD : ASYMPTOMATIC_LATENT_PERIOD; 
+    }
+
+    // agent interface of infectiousness() and progress() 
+    enum SEIHCRD status(){
+      return state->health_status; 
+    }
+
+    bool isSymptomatic(){
+      return symptomatic; 
+    }
+
+    int ageGroup(){
+      return ::ageGroup(age); 
+    }
+
+    enum AtLocation atLocation(){
+      return state->location; 
+    }
+
+    timestamp enteredAt(timestamp /*ts*/){
+      return state->record->get(state->health_status); 
+    }
+
+    void transit(enum SEIHCRD to, timestamp ts){
+      state->transit(to, ts); 
+    }
+
     void personalInfo(timestamp ts){
       state->record->printRecord(); 
       cout << "Time " << ts << " Status: " << SEIHCRD[state->health_status] << " Location " << AtLocation[state->location] << " (was) Symptomatic? " << symptomatic << endl; 
@@ -214,280 +379,3317 @@ class Person {
     //   isolate = iso; 
     // }
 
-    /*
-      asymptomatic and infectious -> gamma 
-      asymptomatic and exposed -> 0 
-      sympotomatic and infectious -> 1.5*gamma 
-      symptomatic and exposed and greater than latent period -> gamma
-      symptomatic and exposed and less than latent period -> 0 
-    */
+    // see infectiousness() 
     double getInfectiousness(timestamp ts) {
-      if (state->health_status == SUSCEPTIBLE || state->health_status == RECOVERED || state->health_status == DECEASED) {
-        return 0; 
-      }
+      return getInfectiousness(ts, generator); 
+    }
 
-      double rand_gamma = randGamma();
-      if (state->health_status == EXPOSED){
-        if (symptomatic && (state->record->get(state->health_status) > latent_period)){
-          return rand_gamma; 
-        }
-        return 0; 
-      }
+    double getInfectiousness(timestamp ts, mt19937& gen) {
+      return getInfectiousness(state->health_status, ts, gen); 
+    }
 
-      if (symptomatic){
-        return SYMPTOMATIC_INFECTIOUSNESS_SCALE * rand_gamma; 
-      } else {
-        return rand_gamma; 
-      }
+    // `status` comes from the state buffer of the Location, see Location::run 
+    double getInfectiousness(enum SEIHCRD status, timestamp ts, mt19937& gen) {
+      return infectiousness(*this, status, ts, gen); 
     }
 
     bool underExposed(double infectiousness, double transmission_prob, timestamp ts){
-      if (prob2Bool(infectiousness * transmission_prob)){
+      if (exposureSucceeds(infectiousness, transmission_prob, generator)){
         state->S2E(ts); 
         return true; 
       }
       return false; 
     }
+
+    // the trial of underExposed without the transition, see Location::concurrentContacts 
+    bool exposureSucceeds(double infectiousness, double transmission_prob, mt19937& gen){
+      return prob2Bool(gen, infectiousness * transmission_prob); 
+    }
     
     // handle the state transition 
     enum SEIHCRD statusUpdate(timestamp ts){
+      return statusUpdate(ts, generator); 
+    }
+
+    // see progress() 
+    enum SEIHCRD statusUpdate(timestamp ts, mt19937& gen, bool treated = true){
       // personalInfo(ts); 
-      switch (state->health_status) {
-        case SUSCEPTIBLE: 
-          break; 
-        case EXPOSED:  
-          if (symptomatic && state->record->timeToTransit(state->health_status, ts, INCUBATION_PERIOD)){
-            state->E2I(ts); 
-          } 
-          if (!symptomatic && state->record->timeToTransit(state->health_status, ts, latent_period)){
-            state->E2I(ts); 
-          }
-          break; 
-        case INFECTIOUS: 
-          if (!symptomatic && state->record->timeToTransit(state->health_status, ts, ASYMPTOMATIC_RECOVER)){
-            if (isFatal()){
-              state->I2D(ts); 
-            } else {
-              state->I2R(ts); 
-            }
-          } 
-          if(symptomatic && state->record->timeToTransit(state->health_status, ts, HOSPITALIZATION_DELAY_MEAN)){
-            if (isHospitalized()){
-              state->I2H(ts); 
-            }
-          } 
-          if(symptomatic && state->record->timeToTransit(state->health_status, ts, MILD_RECOVER)){
-            state->I2R(ts); 
-          }
-          break;  
-        case HOSPITALIZED: 
-          assert(DECIDE_CRITICAL < HOSPITAL_DAYS); 
-          // TODO can also use rateByAge for determining critical rate
-          if (state->record->timeToTransit(state->health_status, ts, DECIDE_CRITICAL)){
-            if (isCritical()){
-              state->H2C(ts); 
-            }
-          } 
-          if (state->record->timeToTransit(state->health_status, ts, HOSPITAL_DAYS)){
-            if (isFatal()){
-              state->H2D(ts); 
-            } else {
-              state->H2R(ts);
-            } 
-          }
-          break; 
-        case CRITICAL:  // roll the die only once 
-          if(state->record->timeToTransit(state->health_status, ts, ICU_DAYS)){
-            if (prob2Bool(CRITICAL_DEATH)){
-              state->C2D(ts); 
-            } else {
-              state->C2R(ts); 
-            }
-          }
-          break; 
-        case RECOVERED:
-        case DECEASED: 
-          break;   
-      }
-      return state->health_status; 
+      return progress(*this, ts, gen, treated); 
     }
 }; 
 
-class Location {
+// runs body(block) for block in [0, blocks) on `threads` threads 
+void parallelFor(int threads, PopulationSize blocks, const function<void(PopulationSize)>& body){
+  atomic<PopulationSize> next_block(0); 
+  auto worker = [&](){
+    PopulationSize block; 
+    while ((block = next_block.fetch_add(1)) < blocks){
+      body(block); 
+    }
+  }; 
+  vector<thread> pool; 
+  for (int t = 1; t < threads; ++t){
+    pool.push_back(thread(worker)); 
+  }
+  worker(); 
+  for (auto &t: pool){
+    t.join(); 
+  }
+}
+
+/*
+ * Per-agent array in pages of COW_PAGE entries that copies share: copying one 
+ * only copies the page table, and a page is duplicated the first time a copy 
+ * writes to it while another copy still holds it (see Location::fork). Reads go 
+ * through operator[], writes through set(), which skips writing an equal value 
+ * so settling an unchanged agent never splits a page, or mut(). 
+ * Threads may write different pages at the same time, never the same one. 
+*/
+template <class T>
+class CowVector {
   private: 
-    vector<Person> population; 
-    PopulationSize total; 
+    vector<shared_ptr<T>> pages; 
+    // pages allocated by reserve() and not used yet, last one first 
+    vector<shared_ptr<T>> spare; 
+    size_t n = 0; 
 
-  public:   
-    PopulationSize initial_susceptible; 
-    PopulationSize initial_seed; 
-    enum AtLocation location; 
-    MixedAge age_description; 
-    double transmission_prob; 
-    LocationSummary* summary = new LocationSummary();  
+    static shared_ptr<T> newPage(){
+      return shared_ptr<T>(new T[COW_PAGE](), default_delete<T[]>()); 
+    }
 
-    Location(enum AtLocation loc){
-      initial_susceptible = population_by_location.find(loc)->second;  
-      initial_seed = seed_by_location.find(loc)->second; 
-      total = initial_susceptible + initial_seed; 
-      location = loc; 
-      age_description = MixedAge{make_pair(1, age_by_location.find(loc)->second)}; 
-      transmission_prob = (TransmissionProb()).getTransProb(loc); 
+    // kept out of line so that reads and unchanged writes stay cheap 
+    __attribute__((noinline)) void split(size_t p){
+      shared_ptr<T> copy = newPage(); 
+      copy_n(pages[p].get(), COW_PAGE, copy.get()); 
+      pages[p] = copy; 
     }
 
-    Location(enum AtLocation loc, PopulationSize p, PopulationSize s, MixedAge defined_age, NPI policy) {
-      initial_susceptible = p; 
-      initial_seed = s; 
-      total = initial_susceptible + initial_seed; 
-      location = loc; 
-      age_description = defined_age; 
-      transmission_prob = (TransmissionProb(policy)).getTransProb(loc); 
+    T* writable(size_t p){
+      if (pages[p].use_count() > 1){
+        split(p); 
+      }
+      return pages[p].get(); 
     }
 
-    Location(enum AtLocation loc, vector<Person> pop, MixedAge defined_age, NPI policy){
-      initial_susceptible = pop.size(); 
-      initial_seed = 0; 
-      total = initial_susceptible + initial_seed; 
-      location = loc; 
-      population = pop; 
-      age_description = defined_age; 
-      transmission_prob = (TransmissionProb(policy)).getTransProb(loc); 
+  public: 
+    size_t size() const {
+      return n; 
     }
 
-    void contact(Person a, Person b, timestamp ts){
-      double infectious_a = a.getInfectiousness(ts); 
-      double infectious_b = b.getInfectiousness(ts); 
+    bool empty() const {
+      return n == 0; 
+    }
 
-      if ((a.state->location != b.state->location) ||
-          (infectious_a==0 && infectious_b==0) || 
-          (infectious_a!=0 && infectious_b!=0)){
-          return; 
-      }
-      // asymptomatic case at EXPOSED state is also not infectious
-      if (a.state->health_status == SUSCEPTIBLE){
-        a.underExposed(infectious_b, transmission_prob, ts);
-      } 
-      if (b.state->health_status == SUSCEPTIBLE){
-        b.underExposed(infectious_a, transmission_prob, ts);
-      }
-      return; 
-    } 
+    const T& operator[](size_t i) const {
+      return pages[i / COW_PAGE].get()[i % COW_PAGE]; 
+    }
 
-    // generate the population 
-    void seed(timestamp ts){
-      for (int i = 0; i < initial_seed; i++){
-        SEIHCRD_Transitions* init_state = new SEIHCRD_Transitions(location, EXPOSED, ts); 
-        Person person(init_state, randGaussianMixture(age_description)); 
-        population.push_back(person); 
+    T& mut(size_t i){
+      return writable(i / COW_PAGE)[i % COW_PAGE]; 
+    }
+
+    void set(size_t i, const T& v){
+      if (!((*this)[i] == v)){
+        mut(i) = v; 
       }
     }
 
-    void init(timestamp ts){
-      seed(ts); 
-      if (population.size()!=total){
-        for (int i = 0; i < initial_susceptible; i++){
-          SEIHCRD_Transitions* init_state = new SEIHCRD_Transitions(location, SUSCEPTIBLE, ts); 
-          Person person(init_state, randGaussianMixture(age_description)); 
-          population.push_back(person); 
+    void push_back(const T& v){
+      if (n % COW_PAGE == 0){
+        if (spare.empty()){
+          pages.push_back(newPage()); 
+        } else {
+          pages.push_back(spare.back()); 
+          spare.pop_back(); 
         }
       }
-      // cout << "Total population size " << total << "\n"; 
+      mut(n++) = v; 
     }
 
-    void run(timestamp current_time){
-      // int ncontacts = ceil(PER_CAPITA_CONTACTS*total/2); 
-      int ncontacts = PER_CAPITA_CONTACTS; 
-
-      if (location == SCHOOL){
-        ncontacts *= 2; 
+    // the pages up to `count` entries come from one allocation, laid out like a 
+    // vector; every page still has its own count, the allocation goes with the last 
+    void reserve(size_t count){
+      size_t wanted = (count + COW_PAGE - 1) / COW_PAGE; 
+      size_t have = (n + COW_PAGE - 1) / COW_PAGE + spare.size(); 
+      if (wanted <= have){ return; }
+      shared_ptr<T> block(new T[(wanted - have) * COW_PAGE](), default_delete<T[]>()); 
+      pages.reserve(wanted); 
+      for (size_t p = wanted - have; p-- > 0; ){
+        spare.push_back(shared_ptr<T>(block.get() + p * COW_PAGE, [block](T*){})); 
       }
+    }
 
-      for(PopulationSize i = 0; i < total/ncontacts; ++i){
-        PopulationSize idx1 = randUniform(0, total-1); 
-        PopulationSize idx2 = randUniform(0, total-1); 
-
-        // PopulationSize seed1 = randUniform(0, total-1); 
-        // PopulationSize idx1 = randGaussian(seed1, ncontacts); 
-        // PopulationSize idx2 = randGaussian(seed1, ncontacts); 
-        // if (idx1 == idx2) {
-        //   idx2 += randUniform(0, ncontacts); 
-        // }
-        idx1 = min(total-1, idx1); 
-        idx2 = min(total-1, idx2); 
-        contact(population[idx1], population[idx2], current_time);
+    void assign(size_t count, const T& v){
+      pages.clear(); 
+      spare.clear(); 
+      n = 0; 
+      reserve(count); 
+      while (n < count){
+        push_back(v); 
       }
-      for (auto &p: population){
-        summary->inc(p.statusUpdate(current_time)); 
+    }
+
+    // uses `count` entries at `data` in place, padded to whole pages (e.g. a 
+    // private file mapping, see PopulationFile); `owner` keeps that memory alive 
+    // while any page of it is in use 
+    void adopt(T* data, size_t count, shared_ptr<void> owner){
+      pages.clear(); 
+      spare.clear(); 
+      n = count; 
+      for (size_t p = 0; p * COW_PAGE < count; ++p){
+        pages.push_back(shared_ptr<T>(data + p * COW_PAGE, [owner](T*){})); 
       }
-      summary->publish(); 
-    }; 
+    }
 
-    // assume simulation always starts from 0. 
-    Summary report(){
-      // cout << "Location "<< AtLocation[location] << endl; 
-      return summary->getSummary(); 
+    size_t pageCount() const {
+      return pages.size(); 
+    }
+
+    // pages no other copy holds 
+    size_t ownedPages() const {
+      size_t ans = 0; 
+      for (auto &p: pages){
+        ans += p.use_count() == 1; 
+      }
+      return ans; 
     }
 }; 
 
-class Simulation {
+/*
+ * Age-structured contact sampling for one Location. Agents are grouped by 
+ * ageGroup once (ages do not change during a run) and pairs are drawn from 
+ * n_a * M[a][b] * n_b through a single alias table over the group pairs, so a 
+ * draw is O(1) whatever the matrix. A new matrix or NPI only rebuilds that 
+ * AGE_GROUPS^2 table, never the population. 
+*/
+class AgeMixing {
+  private: 
+    CowVector<uint32_t> by_group;     // agent indices ordered by age group 
+    vector<PopulationSize> offsets;   // group g is by_group[offsets[g], offsets[g+1]) 
+    AliasTable group_pairs; 
+
   public: 
-    timestamp start_time; 
-    timestamp end_time; 
-    int step_size; 
-    int report_interval; 
+    // contacts under the scaled matrix relative to the unscaled one 
+    double contact_scale = 1; 
 
-    Simulation(){
-      start_time = 1; 
-      end_time = 100;  
-      step_size = 1; 
-      report_interval = 10; 
-    }
+    AgeMixing(){}
 
-    Simulation(timestamp start, timestamp end, int step, int interval){
-      start_time = start; 
-      end_time = end; 
-      step_size = step; 
-      report_interval = interval; 
+    // groups[i]: age group of agent i 
+    AgeMixing(const vector<uint8_t>& groups){
+      offsets.assign(AGE_GROUPS + 1, 0); 
+      for (auto g: groups){
+        ++offsets[g + 1]; 
+      }
+      partial_sum(offsets.begin(), offsets.end(), offsets.begin()); 
+      vector<PopulationSize> fill(offsets.begin(), offsets.end() - 1); 
+      by_group.assign(groups.size(), 0); 
+      for (size_t i = 0; i < groups.size(); ++i){
+        by_group.set(fill[groups[i]]++, i); 
+      }
     }
 
-    void start(vector<Location> locations){
-      Log* simulation_log = new Log(); 
-      auto checkpoint = [locations, simulation_log](long long int ts){
-        vector<Summary> daily_aggregate; 
-        cout << ts/DAY << " "; 
-        for (auto loc: locations){
-          daily_aggregate.push_back(loc.report());
-        }
-        simulation_log->log = simulation_log->aggregateSummary(daily_aggregate); 
-      }; 
+    bool empty(){
+      return offsets.empty(); 
+    }
 
-      for (auto &loc: locations){
-        loc.init(start_time); 
-      }
+    PopulationSize groupSize(int g){
+      return offsets[g + 1] - offsets[g]; 
+    }
 
-      for (int timer = start_time; timer < end_time; timer += step_size) {
-        for (auto &loc: locations){
-          loc.run(timer);  
-        }
-        if (timer % report_interval == 0){
-          checkpoint(timer); 
-          simulation_log->printLog(); 
+    // group_scale[g] multiplies every contact of group g 
+    void setMatrix(const ContactMatrix& matrix, const vector<double>& group_scale){
+      vector<double> weights(AGE_GROUPS * AGE_GROUPS); 
+      double unscaled = 0, scaled = 0; 
+      for (int a = 0; a < AGE_GROUPS; ++a){
+        for (int b = 0; b < AGE_GROUPS; ++b){
+          double w = 1.0 * groupSize(a) * matrix[a][b] * groupSize(b); 
+          unscaled += w; 
+          weights[a * AGE_GROUPS + b] = w * group_scale[a] * group_scale[b]; 
+          scaled += weights[a * AGE_GROUPS + b]; 
         }
       }
+      contact_scale = unscaled > 0 ? scaled / unscaled : 0; 
+      if (scaled > 0){
+        group_pairs = AliasTable(weights); 
+      }
+    }
 
-      // simulation_log->printPercent(); 
+    // only valid while contact_scale > 0 
+    void draw(mt19937& gen, PopulationSize& idx1, PopulationSize& idx2){
+      int cell = group_pairs.sample(gen); 
+      int a = cell / AGE_GROUPS; 
+      int b = cell % AGE_GROUPS; 
+      idx1 = by_group[offsets[a] + randUniform(gen, 0, groupSize(a) - 1)]; 
+      idx2 = by_group[offsets[b] + randUniform(gen, 0, groupSize(b) - 1)]; 
     }
 }; 
 
-int main(){
-  // testPerson(); 
-  testSimulation(); 
-  // testInfectiousness(); 
-  // testPolicy(); 
-  return 0; 
-}
+/*
+ * The last CONTACT_HISTORY contacts of every agent of a location, kept in one 
+ * arena allocated up front: agent i owns slots [i*CONTACT_HISTORY, (i+1)*CONTACT_HISTORY) 
+ * and overwrites them round robin, so recording a contact never allocates. 
+ * The arena is paged copy-on-write like the other per-agent arrays, so a fork 
+ * only copies the pages of the agents that meet someone after it. 
+*/
+class ContactHistory {
+  private: 
+    CowVector<uint32_t> contacts; 
+    CowVector<int32_t> ticks; 
+    CowVector<uint8_t> head; 
 
-void testPerson(){
+  public: 
+    void reset(PopulationSize agents){
+      contacts.assign(agents * CONTACT_HISTORY, 0); 
+      ticks.assign(agents * CONTACT_HISTORY, -1); 
+      head.assign(agents, 0); 
+    }
+
+    bool empty(){
+      return head.empty(); 
+    }
+
+    size_t ownedPages() const {
+      return contacts.ownedPages() + ticks.ownedPages() + head.ownedPages(); 
+    }
+
+    size_t pageCount() const {
+      return contacts.pageCount() + ticks.pageCount() + head.pageCount(); 
+    }
+
+    void add(PopulationSize agent, PopulationSize other, timestamp ts){
+      PopulationSize slot = agent * CONTACT_HISTORY + head[agent]; 
+      contacts.set(slot, other); 
+      ticks.set(slot, ts); 
+      head.set(agent, (head[agent] + 1) % CONTACT_HISTORY); 
+    }
+
+    // f(other) for every remembered contact since the given tick 
+    template <class F>
+    void forEach(PopulationSize agent, timestamp since, F f){
+      for (PopulationSize slot = agent * CONTACT_HISTORY; slot < (agent + 1) * CONTACT_HISTORY; ++slot){
+        if (ticks[slot] >= since){
+          f(contacts[slot]); 
+        }
+      }
+    }
+}; 
+
+/*
+ * Scratch of Location::concurrentContacts: the lowest contact index that exposed 
+ * each agent in the current tick. It is allocated once and every slot is back to 
+ * unclaimed between ticks, so a tick only touches the agents it claims. It holds 
+ * nothing between ticks, so a copy starts empty. 
+*/
+class ClaimTable {
+  private: 
+    unique_ptr<atomic<uint32_t>[]> slots; 
+    size_t n = 0; 
+
+  public: 
+    ClaimTable(){}
+    ClaimTable(const ClaimTable&){}
+    ClaimTable& operator=(const ClaimTable&){ return *this; }
+    ClaimTable(ClaimTable&&) = default; 
+    ClaimTable& operator=(ClaimTable&&) = default; 
+
+    void reserve(size_t agents){
+      if (agents <= n){ return; }
+      slots.reset(new atomic<uint32_t>[agents]); 
+      n = agents; 
+      for (size_t i = 0; i < n; ++i){
+        slots[i].store(UINT32_MAX, memory_order_relaxed); 
+      }
+    }
+
+    // CAS-min on the contact index; true for the one claim that found the slot 
+    // unclaimed, whose caller records the agent for apply and reset 
+    bool claim(PopulationSize agent, uint32_t contact){
+      uint32_t current = slots[agent].load(memory_order_relaxed); 
+      while (contact < current){
+        if (slots[agent].compare_exchange_weak(current, contact, memory_order_relaxed)){
+          return current == UINT32_MAX; 
+        }
+      }
+      return false; 
+    }
+
+    uint32_t winner(PopulationSize agent) const {
+      return slots[agent].load(memory_order_relaxed); 
+    }
+
+    void reset(PopulationSize agent){
+      slots[agent].store(UINT32_MAX, memory_order_relaxed); 
+    }
+}; 
+
+class Location {
+  private: 
+    vector<Person> population; 
+    // used instead of population in compact mode 
+    // per-agent arrays are paged copy-on-write (see fork) 
+    CowVector<CompactAgent> compact_population; 
+    PopulationSize total; 
+    // health status of every agent at the start of the tick (read-only during run) 
+    // and at its end (written by run), swapped once the tick is over 
+    CowVector<uint8_t> current_states; 
+    CowVector<uint8_t> next_states; 
+
+    // hospital bookkeeping, only kept when care_tracking is set: a CareState, 
+    // with CARE_WAITED once the current stay went a tick without its bed 
+    CowVector<uint8_t> care_states; 
+    // status changes the hospital or tracing bookkeeping needs, see processChanges 
+    vector<PopulationSize> status_changes; 
+    vector<PopulationSize> bed_requests; 
+    vector<PopulationSize> icu_requests; 
+    PopulationSize released_beds = 0; 
+    PopulationSize released_icu = 0; 
+
+    // infections of the current tick and the infection tick of every agent 
+    // (-1 if unknown), only kept when track_infections is set 
+    vector<InfectionEvent> infections; 
+    CowVector<timestamp> infected_at; 
+
+    // status changes of the current tick, only kept when record_history is set 
+    vector<StateEvent> transitions; 
+
+    // test, trace and isolate, only kept when tracing is set 
+    ContactHistory history; 
+    // contacts met in each contact block of a concurrent tick, reused across ticks 
+    vector<vector<pair<uint32_t, uint32_t>>> block_contacts;
+    // claims of a concurrent tick and the agents each contact block claimed first 
+    ClaimTable claims; 
+    vector<vector<PopulationSize>> block_claims;  
+    CowVector<timestamp> quarantined_until; 
+    CowVector<uint8_t> test_states; 
+    vector<PopulationSize> test_requests; 
+    vector<PopulationSize> positives; 
+
+    // vaccination, only kept when vaccination is set: agents sorted by age group 
+    // (CSR, as in AgeMixing) in a random order within the group, and the next 
+    // one of every group to be offered a dose 
+    CowVector<uint8_t> vaccinated; 
+    CowVector<uint32_t> by_band; 
+    vector<PopulationSize> band_offsets; 
+    vector<PopulationSize> band_next; 
+
+    NPI policy; 
+    AgeMixing mixing; 
+
+    void drawPair(mt19937& gen, PopulationSize& idx1, PopulationSize& idx2){
+      if (!contact_matrix.empty()){
+        mixing.draw(gen, idx1, idx2); 
+      } else {
+        idx1 = randUniform(gen, 0, total-1); 
+        idx2 = randUniform(gen, 0, total-1); 
+      }
+    }
+
+    void resetBuffers(timestamp ts){
+      current_states.assign(total, SUSCEPTIBLE); 
+      for (PopulationSize i = 0; i < total; ++i){
+        current_states.set(i, agentStatus(i)); 
+      }
+      // shares every page until the first write 
+      next_states = current_states; 
+      if (track_infections){
+        // the agents exposed before the first tick are the roots of the tree 
+        infected_at.assign(total, -1); 
+        for (PopulationSize i = 0; i < total; ++i){
+          if (current_states[i] == EXPOSED){
+            infected_at.set(i, agentEnteredAt(i, ts)); 
+            InfectionEvent root = infection(0, i, infected_at[i]); 
+            root.infector = NO_INFECTOR; 
+            root.infector_tick = -1; 
+            infections.push_back(root); 
+          }
+        }
+      }
+      if (care_tracking){
+        care_states.assign(total, NO_CARE); 
+        for (PopulationSize i = 0; i < total; ++i){
+          requestCare(i, static_cast<enum SEIHCRD>(current_states[i])); 
+        }
+      }
+      if (record_history){
+        // every agent's history starts out SUSCEPTIBLE 
+        for (PopulationSize i = 0; i < total; ++i){
+          if (current_states[i] != SUSCEPTIBLE){
+            transitions.push_back(transition(i, agentEnteredAt(i, ts), current_states[i])); 
+          }
+        }
+      }
+      if (vaccination && vaccinated.empty()){
+        vaccinated.assign(total, 0); 
+        band_offsets.assign(AGE_GROUPS + 1, 0); 
+        for (PopulationSize i = 0; i < total; ++i){
+          ++band_offsets[ageGroup(agentAge(i)) + 1]; 
+        }
+        partial_sum(band_offsets.begin(), band_offsets.end(), band_offsets.begin()); 
+        band_next.assign(band_offsets.begin(), band_offsets.end() - 1); 
+        vector<uint32_t> order(total); 
+        vector<PopulationSize> fill = band_next; 
+        for (PopulationSize i = 0; i < total; ++i){
+          order[fill[ageGroup(agentAge(i))]++] = i; 
+        }
+        // shuffled once, so the seeded cases (created first) are not dosed first 
+        for (int g = 0; g < AGE_GROUPS; ++g){
+          shuffle(order.begin() + band_offsets[g], order.begin() + band_offsets[g + 1], generator); 
+        }
+        by_band.assign(total, 0); 
+        for (PopulationSize i = 0; i < total; ++i){
+          by_band.set(i, order[i]); 
+        }
+      }
+      if (tracing && history.empty()){
+        history.reset(total); 
+        quarantined_until.assign(total, 0); 
+        test_states.assign(total, NOT_TESTED); 
+      }
+    }
+
+    void requestCare(PopulationSize i, enum SEIHCRD status){
+      if (status == HOSPITALIZED){
+        care_states.set(i, WAITING_BED); 
+        bed_requests.push_back(i); 
+      } else if (status == CRITICAL){
+        care_states.set(i, WAITING_ICU); 
+        icu_requests.push_back(i); 
+      }
+    }
+
+    // agents that entered or left HOSPITALIZED/CRITICAL this tick give back their 
+    // bed and queue for the one they need now; the pools are only touched by 
+    // HospitalSystem::admit once every location has run. 
+    // with tracing, symptom onset asks for a test and, for agents willing to, 
+    // starts self-isolation. with record_history, every change is kept 
+    void processChanges(timestamp ts){
+      for (auto i: status_changes){
+        if (record_history){
+          transitions.push_back(transition(i, ts, next_states[i])); 
+        }
+        if (care_tracking){
+          if (care(i) == IN_BED){ ++released_beds; }
+          if (care(i) == IN_ICU){ ++released_icu; }
+          care_states.set(i, NO_CARE); 
+          requestCare(i, static_cast<enum SEIHCRD>(next_states[i])); 
+        }
+        if (tracing && next_states[i] == INFECTIOUS && agentSymptomatic(i)){
+          if (agentIsolate(i)){
+            quarantine(i, ts + ISOLATION_DAYS); 
+          }
+          requestTest(i); 
+        }
+      }
+      status_changes.clear(); 
+    }
+
+    void quarantine(PopulationSize i, timestamp until){
+      quarantined_until.set(i, max(quarantined_until[i], until)); 
+    }
+
+    // at most one pending test per agent, none once confirmed 
+    void requestTest(PopulationSize i){
+      if (test_states[i] == NOT_TESTED){
+        test_states.set(i, TEST_PENDING); 
+        test_requests.push_back(i); 
+      }
+    }
+
+    void parallelBlocks(PopulationSize blocks, const function<void(PopulationSize)>& body){
+      parallelFor(threads, blocks, body); 
+    }
+
+    StateEvent transition(PopulationSize i, timestamp ts, uint8_t state){
+      StateEvent e = StateEvent(); 
+      e.tick = ts; 
+      e.agent = i; 
+      e.state = state; 
+      return e; 
+    }
+
+    InfectionEvent infection(PopulationSize infector, PopulationSize infectee, timestamp ts){
+      InfectionEvent e = InfectionEvent(); 
+      e.tick = ts; 
+      e.infector = infector; 
+      e.infectee = infectee; 
+      e.infector_tick = infected_at[infector]; 
+      return e; 
+    }
+
+    // a traveller can expose a susceptible that is neither exposed already this 
+    // tick nor in quarantine 
+    bool importable(PopulationSize idx, timestamp ts){
+      return current_states[idx] == SUSCEPTIBLE && next_states[idx] != EXPOSED && !isQuarantined(idx, ts); 
+    }
+
+    // imported exposures land on random susceptibles, found by rejection; once 
+    // IMPORT_ATTEMPTS draws miss (few susceptibles left) they are drawn from a 
+    // list of all of them instead. only an import with nobody to expose is lost 
+    void importExposures(timestamp ts){
+      vector<PopulationSize> candidates; 
+      bool listed = false; 
+      for (PopulationSize n = 0; n < imported_exposures; ++n){
+        PopulationSize idx = total; 
+        for (int attempt = 0; attempt < IMPORT_ATTEMPTS && idx == total; ++attempt){
+          PopulationSize draw = randUniform(generator, 0, total - 1); 
+          if (importable(draw, ts)){ idx = draw; }
+        }
+        if (idx == total && !listed){
+          for (PopulationSize i = 0; i < total; ++i){
+            if (importable(i, ts)){ candidates.push_back(i); }
+          }
+          listed = true; 
+        }
+        // candidates exposed since the list was made are dropped as they come up 
+        while (idx == total && !candidates.empty()){
+          PopulationSize k = randUniform(generator, 0, candidates.size() - 1); 
+          if (importable(candidates[k], ts)){
+            idx = candidates[k]; 
+          } else {
+            candidates[k] = candidates.back(); 
+            candidates.pop_back(); 
+          }
+        }
+        if (idx == total){
+          ++dropped_imports; 
+          continue; 
+        }
+        if (!vaccination || prob2Bool(generator, susceptibility(idx))){
+          next_states.set(idx, EXPOSED); 
+          if (track_infections){
+            // the infector is in another location 
+            InfectionEvent e = InfectionEvent(); 
+            e.tick = ts; 
+            e.infector = NO_INFECTOR; 
+            e.infector_tick = -1; 
+            e.infectee = idx; 
+            infections.push_back(e); 
+            infected_at.set(idx, ts); 
+          }
+        }
+      }
+      imported_exposures = 0; 
+    }
+
+    // serial contact phase: the first exposure of the tick wins, 
+    // as in concurrentContacts 
+    void expose(PopulationSize infectee, PopulationSize infector, timestamp ts){
+      if (next_states[infectee] == EXPOSED){ return; }
+      next_states.set(infectee, EXPOSED); 
+      if (track_infections){
+        infections.push_back(infection(infector, infectee, ts)); 
+        infected_at.set(infectee, ts); 
+      }
+    }
+
+    // one contact of the buffered tick, reads current_states only. 
+    // returns bit 1 if idx1 got exposed, bit 2 if idx2 did, bit 4 if they met at all 
+    int bufferedContact(PopulationSize idx1, PopulationSize idx2, timestamp ts, mt19937& gen){
+      if (tracing && (quarantined_until[idx1] > ts || quarantined_until[idx2] > ts)){
+        return 0; 
+      }
+      enum SEIHCRD status_a = static_cast<enum SEIHCRD>(current_states[idx1]); 
+      enum SEIHCRD status_b = static_cast<enum SEIHCRD>(current_states[idx2]); 
+      double susceptible_a = susceptibility(idx1); 
+      double susceptible_b = susceptibility(idx2); 
+      if (compact){
+        return pairExposure(compact_population[idx1], compact_population[idx2], status_a, status_b, 
+                            susceptible_a, susceptible_b, ts, gen); 
+      }
+      return pairExposure(population[idx1], population[idx2], status_a, status_b, 
+                          susceptible_a, susceptible_b, ts, gen); 
+    }
+
+    // relative chance of a susceptible agent to get infected by an exposure 
+    double susceptibility(PopulationSize i){
+      return (vaccination && vaccinated[i]) ? 1 - vaccine.infection_efficacy : 1; 
+    }
+
+    template <class Agent>
+    int pairExposure(Agent& a, Agent& b, enum SEIHCRD status_a, enum SEIHCRD status_b, 
+                     double susceptible_a, double susceptible_b, timestamp ts, mt19937& gen){
+      double infectious_a = infectiousness(a, status_a, ts, gen); 
+      double infectious_b = infectiousness(b, status_b, ts, gen); 
+
+      if (a.atLocation() != b.atLocation()){
+        return 0; 
+      }
+      if ((infectious_a==0 && infectious_b==0) || 
+          (infectious_a!=0 && infectious_b!=0)){
+        return 4; 
+      }
+      // same trial as Person::underExposed 
+      int ans = 4; 
+      if (status_a == SUSCEPTIBLE && prob2Bool(gen, infectious_b * transmission_prob * susceptible_a)){
+        ans |= 1; 
+      } 
+      if (status_b == SUSCEPTIBLE && prob2Bool(gen, infectious_a * transmission_prob * susceptible_b)){
+        ans |= 2; 
+      }
+      return ans; 
+    }
+
+    template <class Agent>
+    enum SEIHCRD step(Agent& agent, bool exposed, timestamp ts, mt19937& gen, bool treated, double severity){
+      if (exposed){
+        agent.transit(EXPOSED, ts); 
+      }
+      return progress(agent, ts, gen, treated, severity); 
+    }
+
+    // applies the exposure recorded in next_states, then the agent's own transitions. 
+    // statusUpdate is a no-op for S/R/D, those are settled from the buffer alone. 
+    // agents entering or leaving hospital care (any change with record_history) 
+    // are appended to `changes` 
+    enum SEIHCRD advance(PopulationSize i, timestamp ts, mt19937& gen, vector<PopulationSize>& changes){
+      enum SEIHCRD current = static_cast<enum SEIHCRD>(current_states[i]); 
+      // nothing leads back to SUSCEPTIBLE, so next_states holds it already 
+      if (current == SUSCEPTIBLE && next_states[i] != EXPOSED){
+        return current; 
+      }
+      if (current == RECOVERED || current == DECEASED){
+        next_states.set(i, current); 
+        return current; 
+      }
+      bool treated = true; 
+      if (care_tracking && (current == HOSPITALIZED || current == CRITICAL)){
+        // the outcome counts as untreated after any tick of the stay spent waiting 
+        treated = !(care_states[i] & CARE_WAITED); 
+      }
+      bool exposed = (current == SUSCEPTIBLE); 
+      double severity = (vaccination && vaccinated[i]) ? 1 - vaccine.severity_efficacy : 1; 
+      enum SEIHCRD status; 
+      if (compact){
+        // stepped on a copy, so an agent that stays put never splits its page 
+        CompactAgent agent = compact_population[i]; 
+        status = step(agent, exposed, ts, gen, treated, severity); 
+        compact_population.set(i, agent); 
+      } else {
+        status = step(population[i], exposed, ts, gen, treated, severity); 
+      }
+      next_states.set(i, status); 
+      if (status != current && 
+          (record_history || 
+           (care_tracking && (current == HOSPITALIZED || current == CRITICAL || status == HOSPITALIZED || status == CRITICAL)) || 
+           (tracing && status == INFECTIOUS))){
+        changes.push_back(i); 
+      }
+      return status; 
+    }
+
+  public:   
+    PopulationSize initial_susceptible; 
+    PopulationSize initial_seed; 
+    enum AtLocation location; 
+    MixedAge age_description; 
+    double transmission_prob; 
+    LocationSummary* summary = new LocationSummary();  
+    // threads for both phases of run(), used once a tick has enough contacts 
+    int threads = 1; 
+    PopulationSize concurrent_min_contacts = PARALLEL_CONTACT_MIN; 
+    // queue hospitalized/critical agents for a HospitalSystem instead of unlimited care 
+    bool care_tracking = false; 
+    // age-structured contacts (see AgeMixing), uniform pairs when empty 
+    ContactMatrix contact_matrix; 
+    // store agents as CompactAgent instead of Person, set before init() 
+    bool compact = false; 
+    // record who infected whom (see newInfections), set before the first run() 
+    bool track_infections = false; 
+    // record every status change (see newTransitions), set before the first run() 
+    bool record_history = false; 
+    // test, trace and isolate for a TestingSystem, set before the first run() 
+    bool tracing = false; 
+    // doses from a VaccinationCampaign and their efficacy, set before the first run() 
+    bool vaccination = false; 
+    Vaccine vaccine; 
+    // exposures brought in by travellers this tick (see TravelMatrix), consumed by run() 
+    PopulationSize imported_exposures = 0; 
+    // imported exposures that found nobody to expose, over all ticks 
+    PopulationSize dropped_imports = 0; 
+    // wall time of the phases of the last run() 
+    double contact_seconds = 0; 
+    double update_seconds = 0; 
+
+    Location(enum AtLocation loc){
+      initial_susceptible = population_by_location.find(loc)->second;  
+      initial_seed = seed_by_location.find(loc)->second; 
+      total = initial_susceptible + initial_seed; 
+      location = loc; 
+      age_description = MixedAge{make_pair(1, age_by_location.find(loc)->second)}; 
+      transmission_prob = (TransmissionProb()).getTransProb(loc); 
+    }
+
+    Location(enum AtLocation loc, PopulationSize p, PopulationSize s, MixedAge defined_age, NPI policy) {
+      initial_susceptible = p; 
+      initial_seed = s; 
+      total = initial_susceptible + initial_seed; 
+      location = loc; 
+      age_description = defined_age; 
+      transmission_prob = (TransmissionProb(policy)).getTransProb(loc); 
+      this->policy = policy; 
+    }
+
+    Location(enum AtLocation loc, vector<Person> pop, MixedAge defined_age, NPI policy){
+      initial_susceptible = pop.size(); 
+      initial_seed = 0; 
+      total = initial_susceptible + initial_seed; 
+      location = loc; 
+      population = pop; 
+      age_description = defined_age; 
+      transmission_prob = (TransmissionProb(policy)).getTransProb(loc); 
+      this->policy = policy; 
+    }
+
+    // change the intervention mid-run; with age mixing only the pair table is rebuilt 
+    void setPolicy(NPI new_policy){
+      policy = new_policy; 
+      transmission_prob = (TransmissionProb(policy)).getTransProb(location); 
+      if (!mixing.empty()){
+        mixing.setMatrix(contact_matrix, policy.age_group_contact_scale); 
+      }
+    }
+
+    // after the transmission probabilities changed (see Calibration) 
+    void refreshTransmission(){
+      transmission_prob = (TransmissionProb(policy)).getTransProb(location); 
+    }
+
+    // Person storage only 
+    const vector<Person>& getPopulation(){
+      return population; 
+    }
+
+    // agent attributes for either storage. a compact agent only knows its age 
+    // group and reports its middle age, which is all the model ever uses 
+    int agentAge(PopulationSize i){
+      return compact ? min(compact_population[i].ageGroup() * 10 + 5, 85) : population[i].age; 
+    }
+
+    bool agentSymptomatic(PopulationSize i){
+      return compact ? compact_population[i].isSymptomatic() : population[i].symptomatic; 
+    }
+
+    bool agentIsolate(PopulationSize i){
+      return compact ? compact_population[i].isIsolate() : population[i].isolate; 
+    }
+
+    enum SEIHCRD agentStatus(PopulationSize i){
+      return compact ? compact_population[i].status() : population[i].state->health_status; 
+    }
+
+    timestamp agentEnteredAt(PopulationSize i, timestamp ts){
+      return compact ? compact_population[i].enteredAt(ts) : population[i].enteredAt(ts); 
+    }
+
+    // agents read in place from a population file (see PopulationFile), 
+    // `n` of them padded to whole pages; switches to compact storage 
+    void mapAgents(CompactAgent* agents, PopulationSize n, shared_ptr<void> mapping){
+      compact = true; 
+      population.clear(); 
+      compact_population.adopt(agents, n, mapping); 
+    }
+
+    // append an already generated agent (see WorldImage), up to the declared total 
+    void addAgent(enum SEIHCRD status, int age, bool symp, bool iso, timestamp ts){
+      if (compact){
+        compact_population.push_back(CompactAgent(location, status, ageGroup(age), symp, iso, ts)); 
+      } else {
+        population.push_back(Person(new SEIHCRD_Transitions(location, status, ts), age, symp, iso)); 
+      }
+    }
+
+    void contact(Person a, Person b, timestamp ts){
+      double infectious_a = a.getInfectiousness(ts); 
+      double infectious_b = b.getInfectiousness(ts); 
+
+      if ((a.state->location != b.state->location) ||
+          (infectious_a==0 && infectious_b==0) || 
+          (infectious_a!=0 && infectious_b!=0)){
+          return; 
+      }
+      // asymptomatic case at EXPOSED state is also not infectious
+      if (a.state->health_status == SUSCEPTIBLE){
+        a.underExposed(infectious_b, transmission_prob, ts);
+      } 
+      if (b.state->health_status == SUSCEPTIBLE){
+        b.underExposed(infectious_a, transmission_prob, ts);
+      }
+      return; 
+    } 
+
+    /*
+      Contact phase split across `threads`. Contacts are cut into blocks of 
+      CONTACT_BLOCK, block b draws from its own generator seeded by (tick seed, b), 
+      and every contact reads current_states, so the outcome does not depend on 
+      the number of threads or their interleaving. 
+      A successful exposure claims the susceptible with a CAS-min on the contact 
+      index: the first exposure in contact order wins, as in the serial loop. 
+      Claimed agents are marked EXPOSED in next_states once all workers are done, 
+      from the per-block lists of agents claimed, so no pass runs over every agent. 
+    */
+    void concurrentContacts(PopulationSize pairs, timestamp ts){
+      if ((PopulationSize)current_states.size() != total){
+        resetBuffers(ts); 
+      }
+      claims.reserve(total); 
+
+      // every block buffers its exposures (contact index, event) when tracking 
+      PopulationSize blocks = (pairs + CONTACT_BLOCK - 1) / CONTACT_BLOCK; 
+      vector<vector<pair<uint32_t, InfectionEvent>>> candidates(track_infections ? blocks : 0); 
+      block_claims.resize(max((PopulationSize)block_claims.size(), blocks)); 
+
+      if (tracing){
+        block_contacts.resize(max((PopulationSize)block_contacts.size(), blocks)); 
+      }
+
+      unsigned int tick_seed = generator(); 
+      parallelBlocks(blocks, [&](PopulationSize block){
+        seed_seq block_seed{tick_seed, static_cast<unsigned int>(block)}; 
+        mt19937 gen(block_seed); 
+        PopulationSize last = min(pairs, (block + 1) * CONTACT_BLOCK); 
+        for (PopulationSize i = block * CONTACT_BLOCK; i < last; ++i){
+          PopulationSize idx1, idx2; 
+          drawPair(gen, idx1, idx2); 
+          int exposed = bufferedContact(idx1, idx2, ts, gen); 
+          if ((exposed & 1) && claims.claim(idx1, i)){ block_claims[block].push_back(idx1); }
+          if ((exposed & 2) && claims.claim(idx2, i)){ block_claims[block].push_back(idx2); }
+          if ((exposed & 4) && tracing){
+            block_contacts[block].push_back(make_pair(idx1, idx2)); 
+          }
+          if ((exposed & 3) && track_infections){
+            PopulationSize infectee = (exposed & 1) ? idx1 : idx2; 
+            PopulationSize infector = (exposed & 1) ? idx2 : idx1; 
+            candidates[block].push_back(make_pair(i, infection(infector, infectee, ts))); 
+          }
+        }
+      }); 
+
+      for (PopulationSize b = 0; b < blocks; ++b){
+        for (auto i: block_claims[b]){
+          next_states.set(i, EXPOSED); 
+        }
+      }
+      // in contact order, as in the serial loop 
+      for (PopulationSize b = 0; tracing && b < blocks; ++b){
+        for (auto &c: block_contacts[b]){
+          history.add(c.first, c.second, ts); 
+          history.add(c.second, c.first, ts); 
+        }
+        block_contacts[b].clear(); 
+      }
+      // only the exposure that won the claim infected the agent 
+      for (auto &block: candidates){
+        for (auto &c: block){
+          if (claims.winner(c.second.infectee) == c.first){
+            infections.push_back(c.second); 
+            infected_at.set(c.second.infectee, ts); 
+          }
+        }
+      }
+      for (PopulationSize b = 0; b < blocks; ++b){
+        for (auto i: block_claims[b]){
+          claims.reset(i); 
+        }
+        block_claims[b].clear(); 
+      }
+    }
+
+    // update phase split across `threads`, UPDATE_BLOCK agents per work unit 
+    void concurrentUpdate(timestamp ts){
+      PopulationSize blocks = (total + UPDATE_BLOCK - 1) / UPDATE_BLOCK; 
+      vector<array<PopulationSize, DECEASED + 1>> counts(blocks); 
+      vector<vector<PopulationSize>> changes(blocks); 
+      unsigned int tick_seed = generator(); 
+      parallelBlocks(blocks, [&](PopulationSize block){
+        seed_seq block_seed{tick_seed, static_cast<unsigned int>(block)}; 
+        mt19937 gen(block_seed); 
+        counts[block].fill(0); 
+        PopulationSize last = min(total, (block + 1) * UPDATE_BLOCK); 
+        for (PopulationSize i = block * UPDATE_BLOCK; i < last; ++i){
+          ++counts[block][advance(i, ts, gen, changes[block])]; 
+        }
+      }); 
+      for (auto &c: changes){
+        status_changes.insert(status_changes.end(), c.begin(), c.end()); 
+      }
+      for (int s = SUSCEPTIBLE; s <= DECEASED; ++s){
+        PopulationSize n = 0; 
+        for (auto &c: counts){
+          n += c[s]; 
+        }
+        summary->add(static_cast<enum SEIHCRD>(s), n); 
+      }
+    }
+
+    // draws the attributes the same way for both storages 
+    void generateAgent(enum SEIHCRD status, timestamp ts){
+      int age = randGaussianMixture(age_description); 
+      if (compact){
+        bool symptomatic = prob2Bool(PROB_SYMPTOMATIC); 
+        bool isolate = symptomatic && prob2Bool(INFECTIOUS_SELF_ISOLATE_RATIO); 
+        compact_population.push_back(CompactAgent(location, status, ageGroup(age), symptomatic, isolate, ts)); 
+      } else {
+        SEIHCRD_Transitions* init_state = new SEIHCRD_Transitions(location, status, ts); 
+        Person person(init_state, age); 
+        population.push_back(person); 
+      }
+    }
+
+    PopulationSize stored(){
+      return compact ? compact_population.size() : population.size(); 
+    }
+
+    // generate the population 
+    void seed(timestamp ts){
+      for (int i = 0; i < initial_seed; i++){
+        generateAgent(EXPOSED, ts); 
+      }
+    }
+
+    void init(timestamp ts){
+      if (stored() == total){
+        return; 
+      }
+      if (compact){
+        compact_population.reserve(total); 
+      }
+      seed(ts); 
+      if (stored()!=total){
+        for (int i = 0; i < initial_susceptible; i++){
+          generateAgent(SUSCEPTIBLE, ts); 
+        }
+      }
+      // cout << "Total population size " << total << "\n"; 
+    }
+
+    /*
+      One tick in two phases over double-buffered states: contacts read 
+      current_states and mark exposures in next_states, then every agent applies 
+      its exposure and its own transitions and writes the result to next_states. 
+      Neither phase reads what the other agents write during the tick, so the 
+      iteration order does not matter and both phases run on `threads`. 
+    */
+    void run(timestamp current_time){
+      // int ncontacts = ceil(PER_CAPITA_CONTACTS*total/2); 
+      int ncontacts = PER_CAPITA_CONTACTS; 
+
+      if (location == SCHOOL){
+        ncontacts *= 2; 
+      }
+      if ((PopulationSize)current_states.size() != total){
+        resetBuffers(current_time); 
+      }
+      if (!contact_matrix.empty() && mixing.empty()){
+        vector<uint8_t> groups(total); 
+        for (PopulationSize i = 0; i < total; ++i){
+          groups[i] = ageGroup(agentAge(i)); 
+        }
+        mixing = AgeMixing(groups); 
+        mixing.setMatrix(contact_matrix, policy.age_group_contact_scale); 
+      }
+
+      auto contact_start = chrono::steady_clock::now(); 
+      PopulationSize pairs = total/ncontacts; 
+      if (!contact_matrix.empty()){
+        pairs = llround(pairs * mixing.contact_scale); 
+      }
+      bool concurrent = threads > 1 && pairs >= concurrent_min_contacts; 
+      if (concurrent){
+        concurrentContacts(pairs, current_time); 
+        pairs = 0; 
+      }
+      for(PopulationSize i = 0; i < pairs; ++i){
+        PopulationSize idx1, idx2; 
+        drawPair(generator, idx1, idx2); 
+
+        // PopulationSize seed1 = randUniform(0, total-1); 
+        // PopulationSize idx1 = randGaussian(seed1, ncontacts); 
+        // PopulationSize idx2 = randGaussian(seed1, ncontacts); 
+        // if (idx1 == idx2) {
+        //   idx2 += randUniform(0, ncontacts); 
+        // }
+        idx1 = min(total-1, idx1); 
+        idx2 = min(total-1, idx2); 
+        int exposed = bufferedContact(idx1, idx2, current_time, generator); 
+        if ((exposed & 4) && tracing){
+          history.add(idx1, idx2, current_time); 
+          history.add(idx2, idx1, current_time); 
+        }
+        if (exposed & 1){ expose(idx1, idx2, current_time); }
+        if (exposed & 2){ expose(idx2, idx1, current_time); }
+      }
+      importExposures(current_time); 
+      auto update_start = chrono::steady_clock::now(); 
+      if (concurrent){
+        concurrentUpdate(current_time); 
+      } else {
+        for (PopulationSize i = 0; i < total; ++i){
+          summary->inc(advance(i, current_time, generator, status_changes)); 
+        }
+      }
+      if (care_tracking || tracing || record_history){
+        processChanges(current_time); 
+      }
+      swap(current_states, next_states); 
+      summary->publish(); 
+      auto update_end = chrono::steady_clock::now(); 
+      contact_seconds = chrono::duration<double>(update_start - contact_start).count(); 
+      update_seconds = chrono::duration<double>(update_end - update_start).count(); 
+    }; 
+
+    // infections since the caller last cleared it, in contact order; the 
+    // location field is left for the caller (see InfectionLog::append) 
+    vector<InfectionEvent>& newInfections(){
+      return infections; 
+    }
+
+    // status changes since the caller last cleared it, by tick and agent 
+    // within this location (see HistoryRecorder::append) 
+    vector<StateEvent>& newTransitions(){
+      return transitions; 
+    }
+
+    // TravelMatrix side: agents in a state at the start of the tick 
+    PopulationSize count(enum SEIHCRD state){
+      return summary->last(state); 
+    }
+
+    PopulationSize size(){
+      return total; 
+    }
+
+    // a copy for a Branch: shares every page of the per-agent arrays with this 
+    // location until one of them writes it, but has its own summary. compact 
+    // storage only, a Person owns heap state that both copies would write 
+    Location fork(){
+      if (!compact){
+        throw "Forking needs compact storage!"; 
+      }
+      Location ans = *this; 
+      ans.summary = new LocationSummary(*summary); 
+      return ans; 
+    }
+
+    // pages of the agent storage, state buffers and contact history no fork 
+    // shares, see fork() 
+    size_t ownedPages(){
+      return compact_population.ownedPages() + current_states.ownedPages() + next_states.ownedPages() + 
+             history.ownedPages(); 
+    }
+
+    size_t pageCount(){
+      return compact_population.pageCount() + current_states.pageCount() + next_states.pageCount() + 
+             history.pageCount(); 
+    }
+
+    // contacts an agent makes per tick on average, see run() 
+    double contactsPerTick(){
+      int ncontacts = (location == SCHOOL) ? 2 * PER_CAPITA_CONTACTS : PER_CAPITA_CONTACTS; 
+      return 2.0 / ncontacts * (contact_matrix.empty() ? 1 : mixing.contact_scale); 
+    }
+
+    // VaccinationCampaign side: agents of an age group not offered a dose yet 
+    PopulationSize unvaccinated(int band){
+      return band_offsets[band + 1] - band_next[band]; 
+    }
+
+    // gives up to `doses` doses to the next agents of the age group. only the 
+    // susceptible get one, the others are passed over for good without spending 
+    // a dose. returns the doses given 
+    PopulationSize vaccinate(int band, PopulationSize doses){
+      PopulationSize given = 0; 
+      PopulationSize& next = band_next[band]; 
+      while (given < doses && next < band_offsets[band + 1]){
+        PopulationSize agent = by_band[next++]; 
+        if (current_states[agent] == SUSCEPTIBLE){
+          vaccinated.set(agent, 1); 
+          ++given; 
+        }
+      }
+      return given; 
+    }
+
+    bool isVaccinated(PopulationSize agent){
+      return vaccination && vaccinated[agent]; 
+    }
+
+    // TestingSystem side of test, trace and isolate. 
+    // symptomatic agents and traced contacts waiting for a test, caller clears 
+    vector<PopulationSize>& testRequests(){
+      return test_requests; 
+    }
+
+    // infected agents test positive and isolate; their contacts are traced by trace() 
+    bool test(PopulationSize agent, timestamp ts){
+      enum SEIHCRD status = agentStatus(agent); 
+      bool positive = status == EXPOSED || status == INFECTIOUS || status == HOSPITALIZED || status == CRITICAL; 
+      test_states.set(agent, positive ? TEST_CONFIRMED : NOT_TESTED); 
+      if (positive){
+        quarantine(agent, ts + ISOLATION_DAYS); 
+        positives.push_back(agent); 
+      }
+      return positive; 
+    }
+
+    // one batched pass over the positives of the day: quarantine and test every 
+    // contact they had within TRACE_WINDOW. returns the number of contacts traced 
+    PopulationSize trace(timestamp ts){
+      PopulationSize traced = 0; 
+      for (auto agent: positives){
+        history.forEach(agent, ts - TRACE_WINDOW, [&](PopulationSize other){
+          if (test_states[other] != TEST_CONFIRMED){
+            quarantine(other, ts + QUARANTINE_DAYS); 
+            requestTest(other); 
+            ++traced; 
+          }
+        }); 
+      }
+      positives.clear(); 
+      return traced; 
+    }
+
+    bool isQuarantined(PopulationSize agent, timestamp ts){
+      return tracing && quarantined_until[agent] > ts; 
+    }
+
+    // HospitalSystem side of the care bookkeeping 
+    vector<PopulationSize>& careRequests(enum CareState waiting){
+      return waiting == WAITING_BED ? bed_requests : icu_requests; 
+    }
+
+    PopulationSize takeReleased(enum CareState held){
+      PopulationSize& released = (held == IN_BED) ? released_beds : released_icu; 
+      PopulationSize ans = released; 
+      released = 0; 
+      return ans; 
+    }
+
+    // the CareState of an agent without the CARE_WAITED flag 
+    uint8_t care(PopulationSize agent){
+      return care_states[agent] & ~CARE_WAITED; 
+    }
+
+    bool isWaiting(PopulationSize agent, enum CareState waiting){
+      return care(agent) == waiting; 
+    }
+
+    // a patient the pools had no bed for this tick, its stay counts as untreated 
+    void keepWaiting(PopulationSize agent){
+      care_states.set(agent, care_states[agent] | CARE_WAITED); 
+    }
+
+    bool waited(PopulationSize agent){
+      return care_states[agent] & CARE_WAITED; 
+    }
+
+    // a patient admitted late keeps CARE_WAITED 
+    void admit(PopulationSize agent, enum CareState waiting){
+      care_states.set(agent, (care_states[agent] & CARE_WAITED) | ((waiting == WAITING_BED) ? IN_BED : IN_ICU)); 
+    }
+
+    // assume simulation always starts from 0. 
+    Summary report(){
+      // cout << "Location "<< AtLocation[location] << endl; 
+      return summary->getSummary(); 
+    }
+}; 
+
+/*
+ * Finite bed and ICU pools shared by all locations of a Simulation. 
+ * Locations only record who needs care and who left it during run(); admit() 
+ * then settles all of them in one serial pass per tick, so locations never 
+ * contend on the pools. Waiting agents are served first come first served 
+ * across locations (ties by location order). A patient who waits any tick of 
+ * a stay has the untreated outcome of that stay, even if admitted later, see 
+ * progress(). 
+*/
+class HospitalSystem {
+  private: 
+    // (location index, agent) 
+    deque<pair<size_t, PopulationSize>> bed_queue; 
+    deque<pair<size_t, PopulationSize>> icu_queue; 
+
+    void serve(deque<pair<size_t, PopulationSize>>& queue, vector<Location>& locations, 
+               enum CareState waiting, PopulationSize& in_use, PopulationSize capacity){
+      deque<pair<size_t, PopulationSize>> still_waiting; 
+      for (auto &e: queue){
+        Location& loc = locations[e.first]; 
+        // recovered, died or moved on while waiting 
+        if (!loc.isWaiting(e.second, waiting)){ continue; }
+        if (in_use < capacity){
+          loc.admit(e.second, waiting); 
+          ++in_use; 
+        } else {
+          loc.keepWaiting(e.second); 
+          still_waiting.push_back(e); 
+        }
+      }
+      queue.swap(still_waiting); 
+    }
+
+  public: 
+    PopulationSize beds; 
+    PopulationSize icu_beds; 
+    PopulationSize beds_in_use = 0; 
+    PopulationSize icu_in_use = 0; 
+
+    HospitalSystem(PopulationSize b, PopulationSize icu){
+      beds = b; 
+      icu_beds = icu; 
+    }
+
+    void admit(vector<Location>& locations){
+      for (size_t l = 0; l < locations.size(); ++l){
+        Location& loc = locations[l]; 
+        beds_in_use -= loc.takeReleased(IN_BED); 
+        icu_in_use -= loc.takeReleased(IN_ICU); 
+        for (auto agent: loc.careRequests(WAITING_BED)){
+          bed_queue.push_back(make_pair(l, agent)); 
+        }
+        for (auto agent: loc.careRequests(WAITING_ICU)){
+          icu_queue.push_back(make_pair(l, agent)); 
+        }
+        loc.careRequests(WAITING_BED).clear(); 
+        loc.careRequests(WAITING_ICU).clear(); 
+      }
+      serve(bed_queue, locations, WAITING_BED, beds_in_use, beds); 
+      serve(icu_queue, locations, WAITING_ICU, icu_in_use, icu_beds); 
+    }
+
+    PopulationSize waitingForBed(){
+      return bed_queue.size(); 
+    }
+
+    PopulationSize waitingForICU(){
+      return icu_queue.size(); 
+    }
+}; 
+
+/*
+ * Daily test capacity shared by all locations of a Simulation. Locations queue 
+ * test requests (symptom onset, traced contacts) during run(); they are gathered 
+ * every tick and once a day up to daily_tests of them are served first come 
+ * first served, the rest keep their place. Each location then traces the 
+ * contacts of its positives of the day in one batch. 
+*/
+class TestingSystem {
+  private: 
+    // (location index, agent) 
+    deque<pair<size_t, PopulationSize>> queue; 
+
+  public: 
+    PopulationSize daily_tests; 
+    PopulationSize tests_done = 0; 
+    PopulationSize positive_tests = 0; 
+    PopulationSize traced_contacts = 0; 
+
+    TestingSystem(PopulationSize daily){
+      daily_tests = daily; 
+    }
+
+    void run(vector<Location>& locations, timestamp ts){
+      for (size_t l = 0; l < locations.size(); ++l){
+        for (auto agent: locations[l].testRequests()){
+          queue.push_back(make_pair(l, agent)); 
+        }
+        locations[l].testRequests().clear(); 
+      }
+      if (ts % DAY != 0){
+        return; 
+      }
+      PopulationSize today = min(daily_tests, (PopulationSize)queue.size()); 
+      for (PopulationSize i = 0; i < today; ++i){
+        positive_tests += locations[queue.front().first].test(queue.front().second, ts); 
+        queue.pop_front(); 
+      }
+      tests_done += today; 
+      for (auto &loc: locations){
+        traced_contacts += loc.trace(ts); 
+      }
+    }
+
+    PopulationSize waitingForTest(){
+      return queue.size(); 
+    }
+}; 
+
+/*
+ * Sparse origin-destination travel between the locations of a Simulation, in 
+ * CSR form: the edges of origin o are [offsets[o], offsets[o+1]), each with the 
+ * chance per tick that an agent of o spends the tick at the destination. 
+ * 
+ * Travellers carry infection pressure, not themselves: an infectious agent of 
+ * o travels with probability `rate`, meets an agent of d with the per tick 
+ * contact rate of d, who is susceptible with probability S_d/N_d and gets 
+ * infected with the transmission probability of d. Thinning these Bernoulli 
+ * trials gives one binomial per edge and direction, Bin(I_o, rate * c_d * p_d * S_d/N_d) 
+ * exposures imported into d and Bin(S_o, rate * c_d * p_d * I_d/N_d) susceptible 
+ * travellers coming home exposed, so an edge costs the same whatever the 
+ * number of travellers, and edges without infection on either side cost nothing. 
+ * Edges are processed in blocks of TRAVEL_BLOCK on `threads` threads, each 
+ * block with its own generator, so the result does not depend on the threads. 
+*/
+class TravelMatrix {
+  private: 
+    vector<PopulationSize> offsets; 
+    vector<uint32_t> destinations; 
+    vector<double> rates; 
+
+  public: 
+    int threads = 1; 
+
+    TravelMatrix(){
+      offsets.assign(1, 0); 
+    }
+
+    // edges as (origin, destination, rate), in any order 
+    TravelMatrix(size_t nlocations, vector<tuple<uint32_t, uint32_t, double>> edges){
+      sort(edges.begin(), edges.end()); 
+      offsets.assign(nlocations + 1, 0); 
+      for (auto &e: edges){
+        assert(get<0>(e) < nlocations && get<1>(e) < nlocations); 
+        ++offsets[get<0>(e) + 1]; 
+        destinations.push_back(get<1>(e)); 
+        rates.push_back(get<2>(e)); 
+      }
+      partial_sum(offsets.begin(), offsets.end(), offsets.begin()); 
+    }
+
+    // every location sends `rate` to `degree` distinct random other locations 
+    // (all of them if there are fewer); a repeated draw is drawn again, since a 
+    // second edge to one destination would double its rate 
+    static vector<tuple<uint32_t, uint32_t, double>> randomEdges(size_t nlocations, int degree, double rate, mt19937& gen){
+      vector<tuple<uint32_t, uint32_t, double>> edges; 
+      size_t distinct = nlocations > 1 ? min((size_t)max(degree, 0), nlocations - 1) : 0; 
+      vector<size_t> chosen; 
+      for (size_t o = 0; distinct > 0 && o < nlocations; ++o){
+        chosen.clear(); 
+        while (chosen.size() < distinct){
+          size_t d = randUniform(gen, 0, nlocations - 2); 
+          d = d >= o ? d + 1 : d; 
+          if (find(chosen.begin(), chosen.end(), d) == chosen.end()){
+            chosen.push_back(d); 
+            edges.push_back(make_tuple(o, d, rate)); 
+          }
+        }
+      }
+      return edges; 
+    }
+
+    PopulationSize edges(){
+      return destinations.size(); 
+    }
+
+    // Bin(n, p): by inversion of 32 random bits while n*p < 10, otherwise from 
+    // std::binomial_distribution, which draws as many values from gen as it needs 
+    static PopulationSize draw(mt19937_64& gen, PopulationSize n, double p, uint64_t bits){
+      if (n > 0 && n * p >= 10 && p < 1){
+        return binomial_distribution<PopulationSize>(n, p)(gen); 
+      }
+      return binomialInverse(n, p, (bits + 0.5) / 4294967296.0); 
+    }
+
+    // exposures imported into every location this tick, from the states at its start 
+    vector<PopulationSize> couple(vector<Location>& locations){
+      size_t n = locations.size(); 
+      assert(offsets.size() == n + 1); 
+      vector<PopulationSize> susceptible(n), infectious(n); 
+      vector<double> pressure(n);  // c_d * p_d / N_d 
+      for (size_t l = 0; l < n; ++l){
+        Location& loc = locations[l]; 
+        susceptible[l] = loc.count(SUSCEPTIBLE); 
+        infectious[l] = loc.count(INFECTIOUS); 
+        pressure[l] = loc.size() > 0 ? loc.contactsPerTick() * loc.transmission_prob * 
+                                       INFECTIOUS_ALPHA * INFECTIOUS_BETA / loc.size() : 0; 
+      }
+
+      unique_ptr<atomic<PopulationSize>[]> imports(new atomic<PopulationSize>[n]); 
+      for (size_t l = 0; l < n; ++l){
+        imports[l].store(0, memory_order_relaxed); 
+      }
+      // the origin of each edge block is found by binary search on offsets 
+      PopulationSize blocks = (edges() + TRAVEL_BLOCK - 1) / TRAVEL_BLOCK; 
+      unsigned int tick_seed = generator(); 
+      parallelFor(threads, blocks, [&](PopulationSize block){
+        seed_seq block_seed{tick_seed, static_cast<unsigned int>(block)}; 
+        mt19937_64 gen(block_seed); 
+        PopulationSize first = block * TRAVEL_BLOCK; 
+        PopulationSize last = min(edges(), first + TRAVEL_BLOCK); 
+        size_t o = upper_bound(offsets.begin(), offsets.end(), first) - offsets.begin() - 1; 
+        for (PopulationSize e = first; e < last; ++e){
+          while (offsets[o + 1] <= e){ ++o; }
+          size_t d = destinations[e]; 
+          if (infectious[o] == 0 && infectious[d] == 0){
+            continue; 
+          }
+          // one 64-bit draw gives the uniforms of both directions 
+          uint64_t bits = gen(); 
+          double p_out = min(1.0, rates[e] * pressure[d] * susceptible[d]); 
+          double p_home = min(1.0, rates[e] * pressure[d] * infectious[d]); 
+          PopulationSize exported = draw(gen, infectious[o], p_out, bits >> 32); 
+          PopulationSize brought_home = draw(gen, susceptible[o], p_home, bits & 0xffffffff); 
+          if (exported > 0){ imports[d].fetch_add(exported, memory_order_relaxed); }
+          if (brought_home > 0){ imports[o].fetch_add(brought_home, memory_order_relaxed); }
+        }
+      }); 
+
+      vector<PopulationSize> ans(n); 
+      for (size_t l = 0; l < n; ++l){
+        ans[l] = imports[l].load(memory_order_relaxed); 
+      }
+      return ans; 
+    }
+}; 
+
+/*
+ * Daily doses shared by all locations of a Simulation, given once a day from 
+ * `start` on by age group in priority order. Every location keeps its agents 
+ * pre-sorted by age group, so a day costs O(doses + locations * groups) and 
+ * the ticks in between cost nothing. The doses of a group are split between 
+ * the locations in proportion to the agents still waiting there. 
+*/
+class VaccinationCampaign {
+  public: 
+    PopulationSize daily_doses; 
+    timestamp start; 
+    Vaccine vaccine; 
+    // age groups (see ageGroup) in the order they are offered doses, others never are 
+    vector<int> priority; 
+    PopulationSize doses_given = 0; 
+
+    VaccinationCampaign(PopulationSize daily, timestamp from, Vaccine v, vector<int> order){
+      daily_doses = daily; 
+      start = from; 
+      vaccine = v; 
+      priority = order; 
+    }
+
+    void run(vector<Location>& locations, timestamp ts){
+      if (ts < start || ts % DAY != 0){
+        return; 
+      }
+      PopulationSize doses = daily_doses; 
+      for (auto band: priority){
+        PopulationSize waiting = 0; 
+        for (auto &loc: locations){
+          waiting += loc.unvaccinated(band); 
+        }
+        PopulationSize budget = min(doses, waiting); 
+        if (budget == 0){
+          continue; 
+        }
+        vector<PopulationSize> shares; 
+        for (auto &loc: locations){
+          shares.push_back(budget * loc.unvaccinated(band) / waiting); 
+        }
+        PopulationSize given = 0; 
+        for (size_t l = 0; l < locations.size(); ++l){
+          given += locations[l].vaccinate(band, shares[l]); 
+        }
+        // rounding leftovers and doses the dead did not take, in location order 
+        for (size_t l = 0; l < locations.size() && given < budget; ++l){
+          given += locations[l].vaccinate(band, budget - given); 
+        }
+        doses -= given; 
+        doses_given += given; 
+        if (doses == 0){
+          break; 
+        }
+      }
+    }
+}; 
+
+class Simulation {
+  public: 
+    timestamp start_time; 
+    timestamp end_time; 
+    int step_size; 
+    int report_interval; 
+    // optional shared-memory progress feed, see metrics.hpp 
+    LiveMetrics* metrics = nullptr; 
+    // optional finite hospital capacity, unlimited when absent 
+    HospitalSystem* hospital = nullptr; 
+    // optional daily testing with contact tracing, none when absent 
+    TestingSystem* testing = nullptr; 
+    // optional vaccination campaign 
+    VaccinationCampaign* vaccination = nullptr; 
+    // optional coupling between locations, isolated locations when absent 
+    TravelMatrix* travel = nullptr; 
+    // optional infection event log and Rt estimates 
+    InfectionLog* infection_log = nullptr; 
+    // optional per-agent state history 
+    HistoryRecorder* history = nullptr; 
+
+    Simulation(){
+      start_time = 1; 
+      end_time = 100;  
+      step_size = 1; 
+      report_interval = 10; 
+    }
+
+    Simulation(timestamp start, timestamp end, int step, int interval){
+      start_time = start; 
+      end_time = end; 
+      step_size = step; 
+      report_interval = interval; 
+    }
+
+    // flags every location for the shared systems in use and builds its agents 
+    void prepare(vector<Location>& locations){
+      for (auto &loc: locations){
+        loc.care_tracking = (hospital != nullptr); 
+        loc.track_infections = (infection_log != nullptr); 
+        loc.record_history = (history != nullptr); 
+        loc.tracing = (testing != nullptr); 
+        loc.vaccination = (vaccination != nullptr); 
+        if (vaccination != nullptr){
+          loc.vaccine = vaccination->vaccine; 
+        }
+        loc.init(start_time); 
+      }
+    }
+
+    // one tick: travel, every location, then the shared systems 
+    void step(vector<Location>& locations, timestamp timer){
+      if (travel != nullptr){
+        vector<PopulationSize> imports = travel->couple(locations); 
+        for (size_t l = 0; l < locations.size(); ++l){
+          locations[l].imported_exposures = imports[l]; 
+        }
+      }
+      for (size_t l = 0; l < locations.size(); ++l){
+        locations[l].run(timer);  
+        if (infection_log != nullptr){
+          infection_log->append(l, locations[l].newInfections()); 
+          locations[l].newInfections().clear(); 
+        }
+        if (history != nullptr){
+          history->append(l, locations[l].newTransitions()); 
+          locations[l].newTransitions().clear(); 
+        }
+      }
+      if (hospital != nullptr){
+        hospital->admit(locations); 
+      }
+      if (testing != nullptr){
+        testing->run(locations, timer); 
+      }
+      if (vaccination != nullptr){
+        vaccination->run(locations, timer); 
+      }
+    }
+
+    void start(vector<Location> locations){
+      Log* simulation_log = new Log(); 
+      auto checkpoint = [locations, simulation_log](long long int ts){
+        vector<Summary> daily_aggregate; 
+        cout << ts/DAY << " "; 
+        for (auto loc: locations){
+          daily_aggregate.push_back(loc.report());
+        }
+        simulation_log->log = simulation_log->aggregateSummary(daily_aggregate); 
+      }; 
+
+      prepare(locations); 
+
+      auto publish = [this, &locations](long long int ts, double report_seconds, double elapsed){
+        MetricsSample sample = MetricsSample(); 
+        sample.tick = ts; 
+        sample.end_tick = end_time; 
+        sample.elapsed_seconds = elapsed; 
+        sample.phase_seconds[PHASE_REPORT] = report_seconds; 
+        PopulationSize agents = 0; 
+        for (auto &loc: locations){
+          sample.phase_seconds[PHASE_CONTACT] += loc.contact_seconds; 
+          sample.phase_seconds[PHASE_UPDATE] += loc.update_seconds; 
+          for (auto s: loc.report()){
+            sample.counts[s.first] += s.second; 
+            agents += s.second; 
+          }
+        }
+        if (hospital != nullptr){
+          sample.beds_in_use = hospital->beds_in_use; 
+          sample.icu_in_use = hospital->icu_in_use; 
+          sample.waiting_for_bed = hospital->waitingForBed(); 
+          sample.waiting_for_icu = hospital->waitingForICU(); 
+        }
+        if (testing != nullptr){
+          sample.tests_done = testing->tests_done; 
+          sample.positive_tests = testing->positive_tests; 
+          sample.waiting_for_test = testing->waitingForTest(); 
+        }
+        if (vaccination != nullptr){
+          sample.doses_given = vaccination->doses_given; 
+        }
+        double tick_seconds = sample.phase_seconds[PHASE_CONTACT] + sample.phase_seconds[PHASE_UPDATE]; 
+        sample.agents_per_second = tick_seconds > 0 ? agents / tick_seconds : 0; 
+        metrics->publish(sample); 
+      }; 
+
+      auto sim_start = chrono::steady_clock::now(); 
+      for (int timer = start_time; timer < end_time; timer += step_size) {
+        step(locations, timer); 
+        auto report_start = chrono::steady_clock::now(); 
+        if (timer % report_interval == 0){
+          checkpoint(timer); 
+          simulation_log->printLog(); 
+          if (infection_log != nullptr){
+            infection_log->report(timer/DAY, timer - report_interval + 1, timer + 1); 
+          }
+        }
+        if (metrics != nullptr){
+          auto now = chrono::steady_clock::now(); 
+          publish(timer, chrono::duration<double>(now - report_start).count(), 
+                  chrono::duration<double>(now - sim_start).count()); 
+        }
+      }
+      if (infection_log != nullptr){
+        infection_log->flush(); 
+      }
+      if (history != nullptr && !history->close()){
+        cerr << "Cannot write history, the file is incomplete" << endl; 
+      }
+
+      // simulation_log->printPercent(); 
+    }
+}; 
+
+/*
+ * A running Simulation that steps one tick at a time and forks, for rare-event 
+ * splitting and counterfactuals. A fork copies the page tables of the per-agent 
+ * arrays (see CowVector) and the queues of the shared systems, so a branch 
+ * costs the pages it writes after the fork rather than a whole population. 
+ * Every branch draws from its own generator, swapped in for the global one 
+ * while it steps. The travel matrix is shared; the metrics feed, the 
+ * infection log and the state history stay with the Simulation the root came from. 
+*/
+class Branch {
+  private: 
+    Simulation sim; 
+    vector<Location> locations; 
+    mt19937 rng; 
+
+    Branch(){}
+
+    // own copies of the shared systems that keep state 
+    void copySystems(const Simulation& from){
+      sim = from; 
+      sim.metrics = nullptr; 
+      sim.infection_log = nullptr; 
+      sim.history = nullptr; 
+      sim.hospital = from.hospital ? new HospitalSystem(*from.hospital) : nullptr; 
+      sim.testing = from.testing ? new TestingSystem(*from.testing) : nullptr; 
+      sim.vaccination = from.vaccination ? new VaccinationCampaign(*from.vaccination) : nullptr; 
+    }
+
+  public: 
+    timestamp now; 
+
+    // the root of a tree of branches, needs compact storage (see Location::fork) 
+    Branch(const Simulation& simulation, vector<Location> initial, unsigned int seed){
+      copySystems(simulation); 
+      for (auto &loc: initial){
+        locations.push_back(loc.fork()); 
+      }
+      rng.seed(seed); 
+      swap(generator, rng); 
+      sim.prepare(locations); 
+      swap(generator, rng); 
+      now = sim.start_time; 
+    }
+
+    Branch(const Branch&) = delete; 
+    Branch& operator=(const Branch&) = delete; 
+
+    ~Branch(){
+      for (auto &loc: locations){
+        delete loc.summary; 
+      }
+      delete sim.hospital; 
+      delete sim.testing; 
+      delete sim.vaccination; 
+    }
+
+    // the same state going on with its own generator 
+    unique_ptr<Branch> fork(unsigned int seed){
+      unique_ptr<Branch> ans(new Branch()); 
+      ans->copySystems(sim); 
+      for (auto &loc: locations){
+        ans->locations.push_back(loc.fork()); 
+      }
+      ans->rng.seed(seed); 
+      ans->now = now; 
+      return ans; 
+    }
+
+    // one tick, false once the simulation has ended 
+    bool step(){
+      if (finished()){
+        return false; 
+      }
+      swap(generator, rng); 
+      sim.step(locations, now); 
+      swap(generator, rng); 
+      now += sim.step_size; 
+      return true; 
+    }
+
+    bool finished(){
+      return now >= sim.end_time; 
+    }
+
+    // agents in a state over all locations after the last step 
+    PopulationSize count(enum SEIHCRD state){
+      PopulationSize ans = 0; 
+      for (auto &loc: locations){
+        ans += loc.count(state); 
+      }
+      return ans; 
+    }
+
+    // nobody left who is or may become infectious 
+    bool extinct(){
+      return now > sim.start_time && count(EXPOSED) + count(INFECTIOUS) + count(HOSPITALIZED) + count(CRITICAL) == 0; 
+    }
+
+    // counterfactuals: a new intervention from the next tick on 
+    void setPolicy(NPI policy){
+      for (auto &loc: locations){
+        loc.setPolicy(policy); 
+      }
+    }
+
+    size_t ownedPages(){
+      size_t ans = 0; 
+      for (auto &loc: locations){
+        ans += loc.ownedPages(); 
+      }
+      return ans; 
+    }
+
+    size_t pageCount(){
+      size_t ans = 0; 
+      for (auto &loc: locations){
+        ans += loc.pageCount(); 
+      }
+      return ans; 
+    }
+}; 
+
+/*
+ * Fixed-effort multilevel splitting: the chance that score() reaches the last of 
+ * `levels` before the simulation ends, for outcomes too rare to count in 
+ * replicates. Each stage forks `effort` branches round robin from the states 
+ * that reached the previous level (the root for the first one) and steps each 
+ * until its score reaches the next level, the epidemic dies out or time runs 
+ * out. The fraction that made it estimates the chance of the level given the 
+ * previous one, and the estimate is the product of these fractions. 
+*/
+class Splitting {
+  public: 
+    vector<double> levels;   // increasing 
+    int effort; 
+    function<double(Branch&)> score; 
+    // filled by run(): the chance of each level given the previous one 
+    vector<double> conditional; 
+    long long ticks = 0; 
+    long long forks = 0; 
+
+    Splitting(vector<double> thresholds, int n, function<double(Branch&)> f){
+      levels = thresholds; 
+      effort = n; 
+      score = f; 
+    }
+
+    double run(Branch& root, unsigned int seed){
+      mt19937 seeds(seed); 
+      conditional.clear(); 
+      ticks = forks = 0; 
+      vector<unique_ptr<Branch>> reached; 
+      double estimate = 1; 
+      for (auto level: levels){
+        vector<unique_ptr<Branch>> next; 
+        for (int k = 0; k < effort; ++k){
+          Branch& from = reached.empty() ? root : *reached[k % reached.size()]; 
+          unique_ptr<Branch> branch = from.fork(seeds()); 
+          ++forks; 
+          while (score(*branch) < level && !branch->extinct() && branch->step()){
+            ++ticks; 
+          }
+          if (score(*branch) >= level){
+            next.push_back(move(branch)); 
+          }
+        }
+        conditional.push_back(1.0 * next.size() / effort); 
+        estimate *= conditional.back(); 
+        if (next.empty()){
+          conditional.resize(levels.size(), 0); 
+          break; 
+        }
+        reached = move(next); 
+      }
+      return estimate; 
+    }
+}; 
+
+/*
+ * Binary population file that Locations map as their agent storage: one 
+ * CompactAgent column per location, used in place, so loading costs the page 
+ * faults of the agents touched and no parsing or per-agent construction. The 
+ * mapping is private: the kernel copies the pages a run writes and the file 
+ * never changes. Written from CSV by convert(). 
+ * Layout (native byte order): magic, #locations, #agents, then per location 
+ *   uint32 type, uint32 0, uint64 agents, uint64 exposed, uint64 offset 
+ * and the columns, each at a multiple of POPULATION_ALIGN and padded to whole 
+ * COW_PAGE pages. Every status was entered at tick 0. 
+*/
+#define POPULATION_MAGIC "EPIPOP01"
+#define POPULATION_ALIGN (COW_PAGE * sizeof(CompactAgent))
+#define POPULATION_UNSET 255
+
+class PopulationFile {
+  private: 
+    class Entry {
+      public: 
+        uint32_t type; 
+        uint32_t reserved; 
+        uint64_t agents; 
+        uint64_t exposed; 
+        uint64_t offset; 
+    }; 
+
+    static uint64_t alignUp(uint64_t bytes){
+      return (bytes + POPULATION_ALIGN - 1) / POPULATION_ALIGN * POPULATION_ALIGN; 
+    }
+
+    static void fail(const string& path, long long line, const char* msg){
+      cerr << path << " line " << line << ": " << msg << endl; 
+      throw msg; 
+    }
+
+    // f(begin, end, line number) for every line, without the newline 
+    static void forEachLine(FILE* in, const function<void(const char*, const char*, long long)>& f){
+      vector<char> buffer(1 << 20); 
+      string carry; 
+      long long line = 0; 
+      size_t n; 
+      while ((n = fread(buffer.data(), 1, buffer.size(), in)) > 0){
+        const char* begin = buffer.data(); 
+        const char* end = begin + n; 
+        while (true){
+          const char* newline = static_cast<const char*>(memchr(begin, '\n', end - begin)); 
+          if (newline == nullptr){
+            carry.append(begin, end); 
+            break; 
+          }
+          if (carry.empty()){
+            f(begin, newline, ++line); 
+          } else {
+            carry.append(begin, newline); 
+            f(carry.data(), carry.data() + carry.size(), ++line); 
+            carry.clear(); 
+          }
+          begin = newline + 1; 
+        }
+      }
+      if (!carry.empty()){
+        f(carry.data(), carry.data() + carry.size(), ++line); 
+      }
+    }
+
+    // location,type,age[,exposed] with the type as a name (HOME, ...); 
+    // false on anything else, e.g. a header 
+    static bool parseRow(const char* begin, const char* end, uint64_t& id, int& type, int& age, bool& exposed){
+      while (end > begin && (end[-1] == '\r' || end[-1] == ' ')){ --end; }
+      if (begin == end || !isdigit(static_cast<unsigned char>(*begin))){ return false; }
+      char* cursor; 
+      id = strtoull(begin, &cursor, 10); 
+      if (cursor >= end || *cursor != ','){ return false; }
+      const char* name = cursor + 1; 
+      const char* comma = static_cast<const char*>(memchr(name, ',', end - name)); 
+      if (comma == nullptr){ return false; }
+      type = -1; 
+      for (int t = HOME; t <= CEMENTRY; ++t){
+        if (AtLocation[t].size() == (size_t)(comma - name) && memcmp(AtLocation[t].data(), name, comma - name) == 0){
+          type = t; 
+        }
+      }
+      if (type < 0 || !isdigit(static_cast<unsigned char>(comma[1]))){ return false; }
+      age = strtol(comma + 1, &cursor, 10); 
+      exposed = false; 
+      if (cursor < end && *cursor == ','){
+        exposed = strtol(cursor + 1, &cursor, 10) != 0; 
+      }
+      return cursor == end; 
+    }
+
+  public: 
+    // number of locations in the file, -1 if it is not a population file 
+    static long long locations(const string& path){
+      FILE* in = fopen(path.c_str(), "rb"); 
+      if (in == nullptr){ return -1; }
+      char magic[8]; 
+      uint64_t header[2]; 
+      bool ok = fread(magic, 1, 8, in) == 8 && memcmp(magic, POPULATION_MAGIC, 8) == 0 && 
+                fread(header, sizeof(header), 1, in) == 1; 
+      fclose(in); 
+      return ok ? (long long)header[0] : -1; 
+    }
+
+    // CSV rows `location,type,age[,exposed]`, one per agent in any order, with 
+    // dense location ids from 0 (they become the location indices, see route); 
+    // lines that do not start with a digit are skipped. symptoms and the 
+    // willingness to isolate are drawn here as for generated agents. 
+    // returns the number of agents 
+    static PopulationSize convert(const string& csv, const string& path){
+      FILE* in = fopen(csv.c_str(), "rb"); 
+      if (in == nullptr){
+        cerr << "Cannot open " << csv << endl; 
+        throw "Cannot open population CSV!"; 
+      }
+      vector<uint64_t> agents, exposed; 
+      vector<uint8_t> types; 
+      forEachLine(in, [&](const char* begin, const char* end, long long line){
+        uint64_t id; 
+        int type, age; 
+        bool e; 
+        if (!parseRow(begin, end, id, type, age, e)){
+          if (begin != end && isdigit(static_cast<unsigned char>(*begin))){ fail(csv, line, "expected location,type,age[,exposed]"); }
+          return; 
+        }
+        if (id >= UINT32_MAX){ fail(csv, line, "location id out of range"); }
+        if (id >= agents.size()){
+          agents.resize(id + 1, 0); 
+          exposed.resize(id + 1, 0); 
+          types.resize(id + 1, POPULATION_UNSET); 
+        }
+        if (types[id] != POPULATION_UNSET && types[id] != type){ fail(csv, line, "location with two types"); }
+        types[id] = type; 
+        ++agents[id]; 
+        exposed[id] += e; 
+      }); 
+
+      uint64_t nlocations = agents.size(); 
+      vector<Entry> table(nlocations); 
+      uint64_t offset = alignUp(24 + nlocations * sizeof(Entry)); 
+      uint64_t total = 0; 
+      for (uint64_t l = 0; l < nlocations; ++l){
+        if (agents[l] == 0){
+          fclose(in); 
+          cerr << csv << ": location " << l << " has no agents" << endl; 
+          throw "Location ids must be dense!"; 
+        }
+        table[l].type = types[l]; 
+        table[l].reserved = 0; 
+        table[l].agents = agents[l]; 
+        table[l].exposed = exposed[l]; 
+        table[l].offset = offset; 
+        offset += alignUp(agents[l] * sizeof(CompactAgent)); 
+        total += agents[l]; 
+      }
+
+      string tmp = path + ".tmp"; 
+      int fd = open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644); 
+      void* addr = MAP_FAILED; 
+      if (fd >= 0 && ftruncate(fd, offset) == 0){
+        addr = mmap(nullptr, offset, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0); 
+      }
+      if (fd >= 0){ close(fd); }
+      if (addr == MAP_FAILED){
+        fclose(in); 
+        remove(tmp.c_str()); 
+        cerr << "Cannot write " << path << endl; 
+        throw "Cannot write population file!"; 
+      }
+      char* base = static_cast<char*>(addr); 
+      uint64_t header[2] = {nlocations, total}; 
+      memcpy(base, POPULATION_MAGIC, 8); 
+      memcpy(base + 8, header, sizeof(header)); 
+      memcpy(base + 24, table.data(), nlocations * sizeof(Entry)); 
+
+      // second pass: every agent straight into its column 
+      vector<uint64_t> filled(nlocations, 0); 
+      rewind(in); 
+      forEachLine(in, [&](const char* begin, const char* end, long long){
+        uint64_t id; 
+        int type, age; 
+        bool e; 
+        if (!parseRow(begin, end, id, type, age, e)){ return; }
+        bool symptomatic = prob2Bool(PROB_SYMPTOMATIC); 
+        bool isolate = symptomatic && prob2Bool(INFECTIOUS_SELF_ISOLATE_RATIO); 
+        CompactAgent* column = reinterpret_cast<CompactAgent*>(base + table[id].offset); 
+        column[filled[id]++] = CompactAgent(static_cast<enum AtLocation>(type), e ? EXPOSED : SUSCEPTIBLE, 
+                                            ageGroup(age), symptomatic, isolate, 0); 
+      }); 
+      fclose(in); 
+      if (munmap(addr, offset) != 0 || rename(tmp.c_str(), path.c_str()) != 0){
+        remove(tmp.c_str()); 
+        cerr << "Cannot write " << path << endl; 
+        throw "Cannot write population file!"; 
+      }
+      return total; 
+    }
+
+    // one Location per entry, all under `policy`, with the agents mapped in place 
+    static vector<Location> load(const string& path, NPI policy){
+      int fd = open(path.c_str(), O_RDONLY); 
+      struct stat st; 
+      void* addr = MAP_FAILED; 
+      if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size >= 24){
+        addr = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0); 
+      }
+      if (fd >= 0){ close(fd); }
+      if (addr == MAP_FAILED){
+        cerr << "Cannot map population file " << path << endl; 
+        throw "Cannot map population file!"; 
+      }
+      uint64_t size = st.st_size; 
+      shared_ptr<void> mapping(addr, [size](void* a){ munmap(a, size); }); 
+      char* base = static_cast<char*>(addr); 
+      uint64_t header[2]; 
+      memcpy(header, base + 8, sizeof(header)); 
+      // sizes are compared by division, a corrupt count must not wrap around 
+      bool ok = memcmp(base, POPULATION_MAGIC, 8) == 0 && header[0] <= (size - 24) / sizeof(Entry); 
+
+      vector<Location> ans; 
+      for (uint64_t l = 0; ok && l < header[0]; ++l){
+        Entry e; 
+        memcpy(&e, base + 24 + l * sizeof(Entry), sizeof(Entry)); 
+        ok = e.type <= CEMENTRY && e.agents > 0 && e.exposed <= e.agents && e.offset % POPULATION_ALIGN == 0 && 
+             e.offset <= size && e.agents <= (size - e.offset) / sizeof(CompactAgent) && 
+             alignUp(e.agents * sizeof(CompactAgent)) <= size - e.offset; 
+        // the agent bits index the rate tables and the summary 
+        const CompactAgent* column = reinterpret_cast<const CompactAgent*>(base + e.offset); 
+        for (uint64_t k = 0; ok && k < e.agents; ++k){
+          ok = column[k].status() <= DECEASED && column[k].atLocation() <= CEMENTRY && column[k].ageGroup() < AGE_GROUPS; 
+        }
+        if (!ok){ break; }
+        Location loc(static_cast<enum AtLocation>(e.type), e.agents - e.exposed, e.exposed, MixedAge(), policy); 
+        loc.mapAgents(reinterpret_cast<CompactAgent*>(base + e.offset), e.agents, mapping); 
+        ans.push_back(loc); 
+      }
+      if (!ok){
+        cerr << "Invalid population file " << path << endl; 
+        throw "Invalid population file!"; 
+      }
+      return ans; 
+    }
+}; 
+
+/*
+ * One calibrated parameter with a uniform prior on [low, high]: the transmission 
+ * probability of a location type, or a factor on a whole rate table (rates are 
+ * capped at 1). apply() changes the globals, so it belongs in a process of its 
+ * own (see Calibration). 
+*/
+class CalibrationPrior {
+  public: 
+    bool is_rate; 
+    enum AtLocation location; 
+    enum RateCategory rate; 
+    double low; 
+    double high; 
+
+    CalibrationPrior(){
+      is_rate = false; 
+      location = RANDOM; 
+      rate = HOSPITALIZATION; 
+      low = high = 0; 
+    }
+
+    bool contains(double value) const {
+      return value >= low && value <= high; 
+    }
+
+    void apply(double value) const {
+      if (!is_rate){
+        initial_transmission_prob[location] = value; 
+        return; 
+      }
+      map<int, double>& table = rate == HOSPITALIZATION ? symptomatic_hospitalization_rate : 
+                                rate == ICU ? hospitalized_critical_care_rate : infection_fatality_rate; 
+      for (auto &entry: table){
+        entry.second = min(1.0, entry.second * value); 
+      }
+    }
+
+    string name() const {
+      static const string rates[] = {"HOSPITALIZATION", "ICU", "FATALITY"}; 
+      return is_rate ? "rate " + rates[rate] : "transmission " + AtLocation[location]; 
+    }
+}; 
+
+// target data: `count` agents in `state` over all locations after tick `tick` 
+class Observation {
+  public: 
+    enum SEIHCRD state; 
+    timestamp tick; 
+    double count; 
+}; 
+
+/*
+ * Scenario files replace the hard-coded inputs of testSimulation. 
+ * One directive per line, '#' starts a comment. See scenarios/default.scenario. 
+ * 
+ *   simulation <start> <end> <step> <report_interval>
+ *   transmission <LOCATION> <prob>
+ *   rate <HOSPITALIZATION|ICU|FATALITY> <age_group> <rate>
+ *   default <LOCATION> <population> <seed> <age_mean> <age_var>
+ *   policy <home> <school> <work> <random> <compliance>     (applies to the locations below it)
+ *   location <LOCATION> <population> <seed> [weight:mean:var ...]
+ *   generate <LOCATION> <count> <size_mean> <size_var> <seed_prob> <seed_rate> [weight:mean:var ...]
+ *   population <path>   (every location of a population file, see PopulationFile)
+ *   cache <directory|off>
+ *   mixing <on|off>   (age-structured contacts for the locations below it)
+ *   contacts <LOCATION> <age_group> <AGE_GROUPS weights>   (one row of its contact matrix)
+ *   age_contacts <AGE_GROUPS factors>   (per age group contact scale of the current policy)
+ *   hospital <beds> <icu_beds>   (shared by all locations, unlimited if absent)
+ *   testing <tests per day>   (test, trace and isolate, shared by all locations)
+ *   vaccination <doses per day> <start day> <efficacy vs infection> <efficacy vs severe disease> [age_group ...]
+ *                   (age groups in priority order, oldest first from 20 if absent)
+ *   compact <on|off>   (4-byte CompactAgent storage for all locations, on unless `cache off`)
+ *   travel <edges per location> <rate>   (random travel graph, rate per agent and tick)
+ *   route <from> <to> <rate>   (one travel edge between location indices, in declaration order)
+ *   threads <n>     (threads per tick within each large location and for travel)
+ *   metrics <shm name, e.g. /epidemic>
+ *   infections <path> [compressed]   (infection events, Rt estimates in <path>.rt)
+ *   history <path>   (every status change of every agent, see history.hpp)
+ *   calibrate transmission <LOCATION> <low> <high>   (uniform prior, see Calibration)
+ *   calibrate rate <HOSPITALIZATION|ICU|FATALITY> <low> <high>   (prior of a factor on the whole table)
+ *   observe <STATE> <day> <count>   (target data of the calibration)
+ *   abc <particles> <generations> <workers> <quantile>   (tolerance: that quantile of the last distances)
+*/
+class LocationSpec {
+  public: 
+    enum AtLocation location; 
+    NPI policy; 
+    MixedAge age_description; 
+    bool age_mixing; 
+    PopulationSize population; 
+    PopulationSize seed; 
+    // generate: population and seed are drawn when the world is built 
+    bool generated; 
+    int count; 
+    double size_mean; 
+    double size_var; 
+    double seed_prob; 
+    double seed_rate; 
+    // population: `count` locations mapped from this file, never cached 
+    string population_file; 
+
+    LocationSpec(){
+      location = RANDOM; 
+      age_mixing = false; 
+      population = 0; 
+      seed = 0; 
+      generated = false; 
+      count = 1; 
+      size_mean = size_var = seed_prob = seed_rate = 0; 
+    }
+}; 
+
+class Scenario {
+  private: 
+    const char* cursor; 
+    const char* line_end; 
+    int line_no; 
+    // a compact directive was read, otherwise compact follows the cache 
+    bool compact_given; 
+
+    void fail(const char* msg){
+      cerr << "Scenario line " << line_no << ": " << msg << endl; 
+      throw msg; 
+    }
+
+    void skipBlank(){
+      while (cursor < line_end && (*cursor == ' ' || *cursor == '\t' || *cursor == '\r')){
+        ++cursor; 
+      }
+    }
+
+    bool atEnd(){
+      skipBlank(); 
+      return cursor >= line_end || *cursor == '#'; 
+    }
+
+    string word(){
+      skipBlank(); 
+      const char* begin = cursor; 
+      while (cursor < line_end && *cursor != ' ' && *cursor != '\t' && *cursor != '\r' && *cursor != ':'){
+        ++cursor; 
+      }
+      if (begin == cursor){ fail("missing argument"); }
+      return string(begin, cursor); 
+    }
+
+    // strtod stops at the first non-numeric char, so the line is never copied 
+    double number(){
+      skipBlank(); 
+      char* end; 
+      double ans = strtod(cursor, &end); 
+      if (end == cursor || end > line_end){ fail("expected a number"); }
+      cursor = end; 
+      return ans; 
+    }
+
+    enum AtLocation locationName(){
+      string name = word(); 
+      for (int i = HOME; i <= CEMENTRY; ++i){
+        if (name == AtLocation[i]){ return static_cast<enum AtLocation>(i); }
+      }
+      fail("unknown location"); 
+      return RANDOM; 
+    }
+
+    enum SEIHCRD stateName(){
+      string name = word(); 
+      for (int s = SUSCEPTIBLE; s <= DECEASED; ++s){
+        if (name == SEIHCRD[s]){ return static_cast<enum SEIHCRD>(s); }
+      }
+      fail("unknown state"); 
+      return SUSCEPTIBLE; 
+    }
+
+    MixedAge mixture(enum AtLocation loc){
+      MixedAge ans; 
+      while (!atEnd()){
+        double weight = number(); 
+        if (cursor >= line_end || *cursor != ':'){ fail("expected weight:mean:var"); }
+        ++cursor; 
+        double mean = number(); 
+        if (cursor >= line_end || *cursor != ':'){ fail("expected weight:mean:var"); }
+        ++cursor; 
+        double var = number(); 
+        ans.push_back(make_pair(weight, AgeInfo(mean, var))); 
+      }
+      if (ans.empty()){
+        ans.push_back(make_pair(1, age_by_location.find(loc)->second)); 
+      }
+      return ans; 
+    }
+
+    void directive(){
+      string key = word(); 
+      if (key == "simulation"){
+        start_time = number(); 
+        end_time = number(); 
+        step_size = number(); 
+        report_interval = number(); 
+        if (end_time < start_time){ fail("simulation ends before it starts"); }
+        if (step_size <= 0 || report_interval <= 0){ fail("step and report interval must be positive"); }
+      } else if (key == "transmission"){
+        enum AtLocation loc = locationName(); 
+        initial_transmission_prob[loc] = number(); 
+      } else if (key == "rate"){
+        string category = word(); 
+        int age_group = number(); 
+        double rate = number(); 
+        if (category == "HOSPITALIZATION"){
+          symptomatic_hospitalization_rate[age_group] = rate; 
+        } else if (category == "ICU"){
+          hospitalized_critical_care_rate[age_group] = rate; 
+        } else if (category == "FATALITY"){
+          infection_fatality_rate[age_group] = rate; 
+        } else {
+          fail("unknown rate category"); 
+        }
+      } else if (key == "default"){
+        enum AtLocation loc = locationName(); 
+        population_by_location[loc] = number(); 
+        seed_by_location[loc] = number(); 
+        double mean = number(); 
+        age_by_location[loc] = AgeInfo(mean, number()); 
+      } else if (key == "policy"){
+        double home = number(); 
+        double school = number(); 
+        double work = number(); 
+        double random = number(); 
+        current_policy = NPI(home, school, work, random, number()); 
+      } else if (key == "location"){
+        LocationSpec spec; 
+        spec.location = locationName(); 
+        spec.policy = current_policy; 
+        spec.age_mixing = age_mixing; 
+        spec.population = number(); 
+        spec.seed = number(); 
+        spec.age_description = mixture(spec.location); 
+        specs.push_back(spec); 
+      } else if (key == "generate"){
+        LocationSpec spec; 
+        spec.location = locationName(); 
+        spec.policy = current_policy; 
+        spec.age_mixing = age_mixing; 
+        spec.generated = true; 
+        spec.count = number(); 
+        spec.size_mean = number(); 
+        spec.size_var = number(); 
+        spec.seed_prob = number(); 
+        spec.seed_rate = number(); 
+        spec.age_description = mixture(spec.location); 
+        specs.push_back(spec); 
+      } else if (key == "population"){
+        LocationSpec spec; 
+        spec.policy = current_policy; 
+        spec.age_mixing = age_mixing; 
+        spec.population_file = word(); 
+        spec.count = PopulationFile::locations(spec.population_file); 
+        if (spec.count < 0){ fail("cannot read population file"); }
+        specs.push_back(spec); 
+      } else if (key == "cache"){
+        cache_dir = word(); 
+      } else if (key == "mixing"){
+        string mode = word(); 
+        if (mode != "on" && mode != "off"){ fail("expected on or off"); }
+        age_mixing = (mode == "on"); 
+      } else if (key == "contacts"){
+        enum AtLocation loc = locationName(); 
+        int group = number(); 
+        if (group < 0 || group >= AGE_GROUPS){ fail("invalid age group"); }
+        if (!contact_matrix_by_location.count(loc)){
+          contact_matrix_by_location[loc] = defaultContactMatrix(loc); 
+        }
+        for (int j = 0; j < AGE_GROUPS; ++j){
+          contact_matrix_by_location[loc][group][j] = number(); 
+        }
+      } else if (key == "age_contacts"){
+        for (int g = 0; g < AGE_GROUPS; ++g){
+          current_policy.age_group_contact_scale[g] = number(); 
+        }
+      } else if (key == "hospital"){
+        hospital_beds = number(); 
+        icu_beds = number(); 
+      } else if (key == "compact"){
+        string mode = word(); 
+        if (mode != "on" && mode != "off"){ fail("expected on or off"); }
+        compact = (mode == "on"); 
+        compact_given = true; 
+      } else if (key == "testing"){
+        daily_tests = number(); 
+      } else if (key == "vaccination"){
+        daily_doses = number(); 
+        vaccination_start = number() * DAY; 
+        vaccine.infection_efficacy = number(); 
+        vaccine.severity_efficacy = number(); 
+        vaccination_priority.clear(); 
+        while (!atEnd()){
+          int group = number(); 
+          if (group < 0 || group >= AGE_GROUPS){ fail("invalid age group"); }
+          vaccination_priority.push_back(group); 
+        }
+        if (vaccination_priority.empty()){
+          // oldest first, from 20 on 
+          for (int g = AGE_GROUPS - 1; g >= 2; --g){
+            vaccination_priority.push_back(g); 
+          }
+        }
+      } else if (key == "travel"){
+        travel_degree = number(); 
+        travel_rate = number(); 
+      } else if (key == "route"){
+        int from = number(); 
+        int to = number(); 
+        routes.push_back(make_tuple(from, to, number())); 
+      } else if (key == "threads"){
+        threads = number(); 
+      } else if (key == "metrics"){
+        metrics_name = word(); 
+      } else if (key == "infections"){
+        infections_path = word(); 
+        infections_compressed = false; 
+        if (!atEnd()){
+          if (word() != "compressed"){ fail("expected compressed"); }
+          infections_compressed = true; 
+        }
+      } else if (key == "history"){
+        history_path = word(); 
+      } else if (key == "calibrate"){
+        CalibrationPrior prior; 
+        string kind = word(); 
+        if (kind == "transmission"){
+          prior.location = locationName(); 
+        } else if (kind == "rate"){
+          string category = word(); 
+          prior.is_rate = true; 
+          if (category == "HOSPITALIZATION"){
+            prior.rate = HOSPITALIZATION; 
+          } else if (category == "ICU"){
+            prior.rate = ICU; 
+          } else if (category == "FATALITY"){
+            prior.rate = FATALITY; 
+          } else {
+            fail("unknown rate category"); 
+          }
+        } else {
+          fail("expected transmission or rate"); 
+        }
+        prior.low = number(); 
+        prior.high = number(); 
+        if (!(prior.low < prior.high)){ fail("empty prior range"); }
+        priors.push_back(prior); 
+      } else if (key == "observe"){
+        Observation observation; 
+        observation.state = stateName(); 
+        observation.tick = number() * DAY; 
+        observation.count = number(); 
+        observations.push_back(observation); 
+      } else if (key == "abc"){
+        abc_particles = number(); 
+        abc_generations = number(); 
+        abc_workers = number(); 
+        abc_quantile = number(); 
+        if (abc_particles < 1 || abc_generations < 1 || abc_workers < 1){ fail("expected positive counts"); }
+        if (!(abc_quantile > 0 && abc_quantile <= 1)){ fail("quantile must be in (0, 1]"); }
+      } else {
+        fail("unknown directive"); 
+      }
+      if (!atEnd()){ fail("trailing characters"); }
+    }
+
+  public: 
+    timestamp start_time; 
+    timestamp end_time; 
+    int step_size; 
+    int report_interval; 
+    NPI current_policy; 
+    bool age_mixing; 
+    // store agents as CompactAgent 
+    bool compact; 
+    vector<LocationSpec> specs; 
+    string cache_dir; 
+    int threads; 
+    // negative: unlimited hospital capacity 
+    PopulationSize hospital_beds; 
+    PopulationSize icu_beds; 
+    // negative: no testing or tracing 
+    PopulationSize daily_tests; 
+    // negative: no vaccination 
+    PopulationSize daily_doses; 
+    timestamp vaccination_start; 
+    Vaccine vaccine; 
+    vector<int> vaccination_priority; 
+    // random travel graph (edges per location, rate) plus explicit routes 
+    // between location indices, in the order the locations are declared 
+    int travel_degree; 
+    double travel_rate; 
+    vector<tuple<uint32_t, uint32_t, double>> routes; 
+    // shared-memory name for LiveMetrics, empty when disabled 
+    string metrics_name; 
+    // infection event log, empty when disabled 
+    string infections_path; 
+    bool infections_compressed; 
+    // per-agent state history, empty when disabled 
+    string history_path; 
+    // calibration, see Calibration 
+    vector<CalibrationPrior> priors; 
+    vector<Observation> observations; 
+    int abc_particles; 
+    int abc_generations; 
+    int abc_workers; 
+    double abc_quantile; 
+    // FNV-1a over the file content, keys the world image 
+    unsigned long long hash; 
+
+    Scenario(){
+      Simulation defaults; 
+      start_time = defaults.start_time; 
+      end_time = defaults.end_time; 
+      step_size = defaults.step_size; 
+      report_interval = defaults.report_interval; 
+      cache_dir = ".world_cache"; 
+      threads = 1; 
+      age_mixing = false; 
+      compact = false; 
+      compact_given = false; 
+      infections_compressed = false; 
+      hospital_beds = icu_beds = -1; 
+      daily_tests = -1; 
+      daily_doses = -1; 
+      travel_degree = 0; 
+      travel_rate = 0; 
+      vaccination_start = 0; 
+      abc_particles = 100; 
+      abc_generations = 5; 
+      abc_workers = max(1u, thread::hardware_concurrency()); 
+      abc_quantile = 0.5; 
+      hash = 14695981039346656037ULL; 
+    }
+
+    void parse(const string& text){
+      for (auto c: text){
+        hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ULL; 
+      }
+      const char* begin = text.data(); 
+      const char* end = begin + text.size(); 
+      line_no = 0; 
+      while (begin < end){
+        ++line_no; 
+        line_end = static_cast<const char*>(memchr(begin, '\n', end - begin)); 
+        if (line_end == nullptr){ line_end = end; }
+        cursor = begin; 
+        if (!atEnd()){ directive(); }
+        begin = line_end + 1; 
+      }
+      // only compact worlds restore quickly, see WorldImage 
+      if (!compact_given){
+        compact = (cache_dir != "off"); 
+      }
+    }
+
+    void load(const char* path){
+      ifstream in(path, ios::binary); 
+      if (!in){
+        cerr << "Cannot open scenario " << path << endl; 
+        throw "Cannot open scenario!"; 
+      }
+      string text((istreambuf_iterator<char>(in)), istreambuf_iterator<char>()); 
+      parse(text); 
+    }
+
+    Simulation simulation(){
+      Simulation sim(start_time, end_time, step_size, report_interval); 
+      if (hospital_beds >= 0){
+        sim.hospital = new HospitalSystem(hospital_beds, icu_beds); 
+      }
+      if (daily_tests >= 0){
+        sim.testing = new TestingSystem(daily_tests); 
+      }
+      if (daily_doses >= 0){
+        sim.vaccination = new VaccinationCampaign(daily_doses, vaccination_start, vaccine, vaccination_priority); 
+      }
+      if (travel_degree > 0 || !routes.empty()){
+        size_t nlocations = 0; 
+        for (auto &spec: specs){
+          nlocations += spec.count; 
+        }
+        vector<tuple<uint32_t, uint32_t, double>> edges = TravelMatrix::randomEdges(nlocations, travel_degree, travel_rate, generator); 
+        edges.insert(edges.end(), routes.begin(), routes.end()); 
+        for (auto &e: edges){
+          if (get<0>(e) >= nlocations || get<1>(e) >= nlocations){
+            cerr << "Route between unknown locations " << get<0>(e) << " " << get<1>(e) << endl; 
+            throw "Invalid route!"; 
+          }
+        }
+        sim.travel = new TravelMatrix(nlocations, edges); 
+        sim.travel->threads = threads; 
+      }
+      if (!metrics_name.empty()){
+        sim.metrics = LiveMetrics::create(metrics_name); 
+        if (sim.metrics == nullptr){
+          cerr << "Cannot create metrics segment " << metrics_name << endl; 
+        }
+      }
+      if (!infections_path.empty()){
+        sim.infection_log = InfectionLog::create(infections_path, infections_compressed); 
+        if (sim.infection_log == nullptr){
+          cerr << "Cannot create infection log " << infections_path << endl; 
+        }
+      }
+      if (!history_path.empty()){
+        sim.history = HistoryRecorder::create(history_path); 
+        if (sim.history == nullptr){
+          cerr << "Cannot create history " << history_path << endl; 
+        }
+      }
+      return sim; 
+    }
+
+    // for drivers whose runs write no outputs (split, calibrate): simulation() 
+    // then opens no metrics segment, infection log or history file 
+    void dropOutputs(){
+      metrics_name.clear(); 
+      infections_path.clear(); 
+      history_path.clear(); 
+    }
+}; 
+
+/*
+ * Binary snapshot of the generated population of every location in a scenario, 
+ * so repeated runs of the same scenario skip the age/symptom sampling. Only 
+ * compact storage restores quickly (about 20 ms for 700k agents); a Person 
+ * still gets its heap state built on restore, which costs about as much as 
+ * generating it (about 1 s for the same agents), so Scenario only keeps 
+ * Person storage with the cache on when `compact off` asks for it. 
+ * Layout: magic, hash, model, #locations, then per location 
+ *   type, susceptible, seed, n, int32 age[n], uint8 flags[n]
+ * Images of another model (see model()) are stale like those of another scenario. 
+*/
+#define WORLD_IMAGE_MAGIC "EPIWRLD2"
+// bump with every change to how agents are generated or stored in the image 
+#define WORLD_IMAGE_VERSION 2
+#define WORLD_FLAG_SYMPTOMATIC 1
+#define WORLD_FLAG_ISOLATE 2
+#define WORLD_FLAG_EXPOSED 4
+
+class WorldImage {
+  private: 
+    static string path(Scenario& scenario){
+      char name[32]; 
+      snprintf(name, sizeof(name), "/%016llx.world", scenario.hash); 
+      return scenario.cache_dir + name; 
+    }
+
+    static bool enabled(Scenario& scenario){
+      return scenario.cache_dir != "off"; 
+    }
+
+    // FNV-1a over the version and the constants agents are drawn with 
+    static unsigned long long model(){
+      unsigned long long ans = 14695981039346656037ULL; 
+      double constants[] = {WORLD_IMAGE_VERSION, PROB_SYMPTOMATIC, INFECTIOUS_SELF_ISOLATE_RATIO, AGE_GROUPS}; 
+      const unsigned char* bytes = reinterpret_cast<const unsigned char*>(constants); 
+      for (size_t i = 0; i < sizeof(constants); ++i){
+        ans = (ans ^ bytes[i]) * 1099511628211ULL; 
+      }
+      return ans; 
+    }
+
+    // expand `generate` into concrete (location, population, seed) triples 
+    static vector<Location> generate(Scenario& scenario){
+      vector<Location> ans; 
+      for (auto &spec: scenario.specs){
+        for (int i = 0; spec.population_file.empty() && i < spec.count; ++i){
+          PopulationSize size = spec.population; 
+          PopulationSize seed_val = spec.seed; 
+          if (spec.generated){
+            size = randGaussian(spec.size_mean, spec.size_var); 
+            seed_val = 0; 
+            if (prob2Bool(spec.seed_prob)){
+              seed_val = spec.seed_rate * size; 
+            }
+          }
+          Location loc(spec.location, size, seed_val, spec.age_description, spec.policy); 
+          loc.compact = scenario.compact; 
+          loc.init(scenario.start_time); 
+          ans.push_back(loc); 
+        }
+      }
+      return ans; 
+    }
+
+    static void save(Scenario& scenario, vector<Location>& locations){
+      mkdir(scenario.cache_dir.c_str(), 0755); 
+      string target = path(scenario); 
+      string tmp = target + ".tmp"; 
+      FILE* out = fopen(tmp.c_str(), "wb"); 
+      if (out == nullptr){ return; }
+
+      unsigned long long nlocations = locations.size(); 
+      unsigned long long version = model(); 
+      fwrite(WORLD_IMAGE_MAGIC, 1, 8, out); 
+      fwrite(&scenario.hash, sizeof(scenario.hash), 1, out); 
+      fwrite(&version, sizeof(version), 1, out); 
+      fwrite(&nlocations, sizeof(nlocations), 1, out); 
+
+      vector<int32_t> ages; 
+      vector<uint8_t> flags; 
+      for (auto &loc: locations){
+        int32_t type = loc.location; 
+        long long header[3] = {loc.initial_susceptible, loc.initial_seed, loc.stored()}; 
+        ages.clear(); 
+        flags.clear(); 
+        for (PopulationSize i = 0; i < loc.stored(); ++i){
+          ages.push_back(loc.agentAge(i)); 
+          flags.push_back((loc.agentSymptomatic(i) ? WORLD_FLAG_SYMPTOMATIC : 0) | 
+                          (loc.agentIsolate(i) ? WORLD_FLAG_ISOLATE : 0) | 
+                          (loc.agentStatus(i) == EXPOSED ? WORLD_FLAG_EXPOSED : 0)); 
+        }
+        fwrite(&type, sizeof(type), 1, out); 
+        fwrite(header, sizeof(header), 1, out); 
+        fwrite(ages.data(), sizeof(int32_t), ages.size(), out); 
+        fwrite(flags.data(), sizeof(uint8_t), flags.size(), out); 
+      }
+      bool ok = !ferror(out); 
+      fclose(out); 
+      if (ok){
+        rename(tmp.c_str(), target.c_str()); 
+      } else {
+        remove(tmp.c_str()); 
+      }
+    }
+
+    // returns false (and an empty vector) when the image is missing or stale 
+    static bool restore(Scenario& scenario, vector<Location>& locations){
+      FILE* in = fopen(path(scenario).c_str(), "rb"); 
+      if (in == nullptr){ return false; }
+
+      unsigned long long expected = 0; 
+      for (auto &spec: scenario.specs){
+        expected += spec.population_file.empty() ? spec.count : 0; 
+      }
+
+      char magic[8]; 
+      unsigned long long hash = 0, version = 0, nlocations = 0; 
+      bool ok = fread(magic, 1, 8, in) == 8 && memcmp(magic, WORLD_IMAGE_MAGIC, 8) == 0 && 
+                fread(&hash, sizeof(hash), 1, in) == 1 && hash == scenario.hash && 
+                fread(&version, sizeof(version), 1, in) == 1 && version == model() && 
+                fread(&nlocations, sizeof(nlocations), 1, in) == 1 && nlocations == expected; 
+
+      vector<int32_t> ages; 
+      vector<uint8_t> flags; 
+      size_t spec_idx = 0; 
+      int spec_count = 0; 
+      for (unsigned long long l = 0; ok && l < nlocations; ++l){
+        while (spec_idx < scenario.specs.size() && 
+               (spec_count == scenario.specs[spec_idx].count || !scenario.specs[spec_idx].population_file.empty())){
+          ++spec_idx; 
+          spec_count = 0; 
+        }
+        if (spec_idx == scenario.specs.size()){ ok = false; break; }
+        LocationSpec& spec = scenario.specs[spec_idx]; 
+        ++spec_count; 
+
+        int32_t type; 
+        long long header[3]; 
+        ok = fread(&type, sizeof(type), 1, in) == 1 && type == spec.location && 
+             fread(header, sizeof(header), 1, in) == 1 && header[0] + header[1] == header[2]; 
+        if (!ok){ break; }
+
+        ages.resize(header[2]); 
+        flags.resize(header[2]); 
+        ok = fread(ages.data(), sizeof(int32_t), ages.size(), in) == ages.size() && 
+             fread(flags.data(), sizeof(uint8_t), flags.size(), in) == flags.size(); 
+        if (!ok){ break; }
+
+        Location loc(spec.location, header[0], header[1], spec.age_description, spec.policy); 
+        loc.compact = scenario.compact; 
+        for (long long i = 0; i < header[2]; ++i){
+          enum SEIHCRD status = (flags[i] & WORLD_FLAG_EXPOSED) ? EXPOSED : SUSCEPTIBLE; 
+          loc.addAgent(status, ages[i], flags[i] & WORLD_FLAG_SYMPTOMATIC, flags[i] & WORLD_FLAG_ISOLATE, scenario.start_time); 
+        }
+        locations.push_back(loc); 
+      }
+      fclose(in); 
+      if (!ok){ locations.clear(); }
+      return ok; 
+    }
+
+  public: 
+    // reuse the cached world for this scenario, or build and cache it; 
+    // locations of population files are mapped in their place 
+    static vector<Location> build(Scenario& scenario){
+      vector<Location> generated; 
+      if (!(enabled(scenario) && restore(scenario, generated))){
+        generated = generate(scenario); 
+        if (enabled(scenario)){
+          save(scenario, generated); 
+        }
+      }
+      vector<Location> locations; 
+      size_t next = 0; 
+      for (auto &spec: scenario.specs){
+        if (!spec.population_file.empty()){
+          vector<Location> mapped = PopulationFile::load(spec.population_file, spec.policy); 
+          locations.insert(locations.end(), mapped.begin(), mapped.end()); 
+          continue; 
+        }
+        for (int i = 0; i < spec.count; ++i){
+          locations.push_back(generated[next++]); 
+        }
+      }
+      size_t l = 0; 
+      for (auto &spec: scenario.specs){
+        for (int i = 0; i < spec.count; ++i, ++l){
+          enum AtLocation type = locations[l].location; 
+          locations[l].threads = scenario.threads; 
+          if (spec.age_mixing){
+            locations[l].contact_matrix = contact_matrix_by_location.count(type) ? 
+              contact_matrix_by_location[type] : defaultContactMatrix(type); 
+          }
+        }
+      }
+      return locations; 
+    }
+}; 
+
+/*
+ * Approximate Bayesian computation by sequential Monte Carlo (ABC-SMC with the 
+ * population Monte Carlo weights of Beaumont et al.) of the parameters in 
+ * `priors` against `observations`. The distance of a run is the root mean 
+ * squared error of log(1 + count) at the observed ticks, so a run that takes 
+ * off too early or too late is off by as much in the first weeks as in the 
+ * peak. Generation 0 accepts every draw from the priors; every later one 
+ * resamples the previous particles, moves them with a Gaussian kernel of twice 
+ * their weighted variance and accepts the runs within the tolerance, a 
+ * quantile of the previous distances. 
+ * 
+ * Candidates run in child processes forked from the prepared world, so they 
+ * share its pages (and mapped population files) copy-on-write and may change 
+ * the model globals and the generator; up to `workers` run at a time. The 
+ * squared errors only add up, so a run stops at the first observation where 
+ * their sum already exceeds the tolerance, and no run goes past the last 
+ * observation. Candidates and their seeds are drawn before they run and 
+ * accepted in that order, so the particles do not depend on `workers`. 
+*/
+#define ABC_MAX_PROPOSALS 100   // per particle and generation, then the generation ends short 
+
+class Calibration {
+  public: 
+    class Particle {
+      public: 
+        vector<double> theta;   // one value per prior 
+        double weight; 
+        double distance; 
+    }; 
+
+    // what a child reports back through its pipe 
+    class Outcome {
+      public: 
+        double distance;   // a lower bound when aborted 
+        long long ticks; 
+        int aborted; 
+    }; 
+
+    vector<CalibrationPrior> priors; 
+    vector<Observation> observations;   // by tick 
+    int particles; 
+    int generations; 
+    int workers; 
+    double quantile; 
+    // filled by run(): the particles of the last generation, the tolerance and 
+    // proposals of every generation, and the ticks simulated against the ticks 
+    // the same runs would have taken up to the last observation 
+    vector<Particle> population; 
+    vector<double> tolerances; 
+    vector<long long> proposals; 
+    long long runs = 0; 
+    long long aborted = 0; 
+    long long ticks = 0; 
+    long long full_ticks = 0; 
+
+    Calibration(const Scenario& scenario){
+      priors = scenario.priors; 
+      observations = scenario.observations; 
+      stable_sort(observations.begin(), observations.end(), [](const Observation& a, const Observation& b){
+        return a.tick < b.tick; 
+      }); 
+      particles = scenario.abc_particles; 
+      generations = scenario.abc_generations; 
+      workers = scenario.abc_workers; 
+      quantile = scenario.abc_quantile; 
+    }
+
+    void run(Simulation sim, vector<Location>& world, unsigned int seed){
+      if (priors.empty() || observations.empty()){
+        cerr << "Calibration needs at least one prior and one observation" << endl; 
+        throw "Nothing to calibrate!"; 
+      }
+      sim.metrics = nullptr; 
+      sim.infection_log = nullptr; 
+      sim.history = nullptr; 
+      sim.prepare(world); 
+      population.clear(); 
+      tolerances.clear(); 
+      proposals.clear(); 
+      runs = aborted = ticks = full_ticks = 0; 
+      long long run_ticks = 0; 
+      for (timestamp timer = sim.start_time; timer < sim.end_time; timer += sim.step_size){
+        ++run_ticks; 
+        if (timer >= observations.back().tick){ break; }
+      }
+
+      double tolerance = numeric_limits<double>::infinity(); 
+      vector<double> scale(priors.size(), 0); 
+      for (int g = 0; g < generations; ++g){
+        vector<double> previous_weights; 
+        for (auto &p: population){
+          previous_weights.push_back(p.weight); 
+        }
+        discrete_distribution<size_t> pick(previous_weights.begin(), previous_weights.end()); 
+        // a batch may run past the last particle it needs, the next generation 
+        // must not depend on how far 
+        seed_seq generation_seed{seed, (unsigned int)g}; 
+        mt19937 rng(generation_seed); 
+        vector<Particle> accepted; 
+        long long proposed = 0; 
+        while ((int)accepted.size() < particles && proposed < (long long)ABC_MAX_PROPOSALS * particles){
+          size_t batch = max((size_t)workers, particles - accepted.size()); 
+          vector<vector<double>> candidates; 
+          vector<unsigned int> seeds; 
+          for (size_t b = 0; b < batch; ++b){
+            candidates.push_back(propose(rng, pick, scale)); 
+            seeds.push_back(rng()); 
+          }
+          vector<Outcome> outcomes = evaluate(sim, world, candidates, seeds, tolerance); 
+          for (size_t b = 0; b < batch; ++b){
+            ++proposed; 
+            ++runs; 
+            ticks += outcomes[b].ticks; 
+            full_ticks += run_ticks; 
+            aborted += outcomes[b].aborted; 
+            if (!outcomes[b].aborted && outcomes[b].distance <= tolerance && (int)accepted.size() < particles){
+              Particle particle; 
+              particle.theta = candidates[b]; 
+              particle.weight = 1; 
+              particle.distance = outcomes[b].distance; 
+              accepted.push_back(particle); 
+            }
+          }
+        }
+        proposals.push_back(proposed); 
+        if (accepted.empty()){
+          // keeps the last generation that made it 
+          tolerances.push_back(tolerance); 
+          break; 
+        }
+        weigh(accepted, scale); 
+        population = accepted; 
+        tolerances.push_back(tolerance); 
+
+        vector<double> distances; 
+        for (auto &p: population){
+          distances.push_back(p.distance); 
+        }
+        sort(distances.begin(), distances.end()); 
+        tolerance = distances[max(0, (int)ceil(quantile * distances.size()) - 1)]; 
+        for (size_t k = 0; k < priors.size(); ++k){
+          scale[k] = max(sqrt(2 * variance(k)), 1e-6 * (priors[k].high - priors[k].low)); 
+        }
+      }
+    }
+
+    // weighted posterior moments of parameter k 
+    double mean(size_t k){
+      double ans = 0; 
+      for (auto &p: population){
+        ans += p.weight * p.theta[k]; 
+      }
+      return ans; 
+    }
+
+    double variance(size_t k){
+      double m = mean(k); 
+      double ans = 0; 
+      for (auto &p: population){
+        ans += p.weight * (p.theta[k] - m) * (p.theta[k] - m); 
+      }
+      return ans; 
+    }
+
+  private: 
+    vector<double> propose(mt19937& rng, discrete_distribution<size_t>& pick, const vector<double>& scale){
+      vector<double> theta(priors.size()); 
+      if (population.empty()){
+        for (size_t k = 0; k < priors.size(); ++k){
+          theta[k] = uniform_real_distribution<double>(priors[k].low, priors[k].high)(rng); 
+        }
+        return theta; 
+      }
+      while (true){
+        const Particle& from = population[pick(rng)]; 
+        bool inside = true; 
+        for (size_t k = 0; k < priors.size(); ++k){
+          theta[k] = from.theta[k] + normal_distribution<double>(0, scale[k])(rng); 
+          inside = inside && priors[k].contains(theta[k]); 
+        }
+        if (inside){ return theta; }
+      }
+    }
+
+    // importance weights against the kernel mixture around the previous 
+    // particles; the uniform priors are flat inside their ranges 
+    void weigh(vector<Particle>& accepted, const vector<double>& scale){
+      double total = 0; 
+      for (auto &p: accepted){
+        if (!population.empty()){
+          double mixture = 0; 
+          for (auto &q: population){
+            double kernel = q.weight; 
+            for (size_t k = 0; k < priors.size(); ++k){
+              double z = (p.theta[k] - q.theta[k]) / scale[k]; 
+              kernel *= exp(-0.5 * z * z); 
+            }
+            mixture += kernel; 
+          }
+          p.weight = mixture > 0 ? 1 / mixture : 0; 
+        }
+        total += p.weight; 
+      }
+      for (auto &p: accepted){
+        p.weight = total > 0 ? p.weight / total : 1.0 / accepted.size(); 
+      }
+    }
+
+    // runs in the child: own globals, own generator, own copy of every page written 
+    Outcome simulate(Simulation& sim, vector<Location>& world, const vector<double>& theta, unsigned int seed, double tolerance){
+      for (size_t k = 0; k < priors.size(); ++k){
+        priors[k].apply(theta[k]); 
+      }
+      for (auto &loc: world){
+        loc.refreshTransmission(); 
+      }
+      generator.seed(seed); 
+
+      Outcome outcome = Outcome(); 
+      double limit = tolerance * tolerance * observations.size(); 
+      double sum = 0; 
+      size_t next = 0; 
+      auto error = [&world](const Observation& observation){
+        double count = 0; 
+        for (auto &loc: world){
+          count += loc.count(observation.state); 
+        }
+        double diff = log1p(count) - log1p(observation.count); 
+        return diff * diff; 
+      }; 
+      for (timestamp timer = sim.start_time; timer < sim.end_time && next < observations.size(); timer += sim.step_size){
+        sim.step(world, timer); 
+        ++outcome.ticks; 
+        for (; next < observations.size() && observations[next].tick <= timer; ++next){
+          sum += error(observations[next]); 
+        }
+        if (sum > limit){
+          outcome.aborted = 1; 
+          break; 
+        }
+      }
+      // observations past the end see the final state 
+      for (; !outcome.aborted && next < observations.size(); ++next){
+        sum += error(observations[next]); 
+      }
+      outcome.distance = sqrt(sum / observations.size()); 
+      return outcome; 
+    }
+
+    vector<Outcome> evaluate(Simulation& sim, vector<Location>& world, const vector<vector<double>>& candidates, 
+                             const vector<unsigned int>& seeds, double tolerance){
+      vector<Outcome> outcomes(candidates.size()); 
+      map<pid_t, pair<size_t, int>> running;   // candidate and read end of the pipe of every child 
+      size_t next = 0; 
+      bool failed = false; 
+      while (next < candidates.size() || !running.empty()){
+        if (!failed && next < candidates.size() && (int)running.size() < workers){
+          int fds[2]; 
+          if (pipe(fds) != 0){ throw "Cannot create pipe!"; }
+          cout.flush(); 
+          pid_t pid = fork(); 
+          if (pid < 0){ throw "Cannot fork!"; }
+          if (pid == 0){
+            // nothing may unwind out of the child into the parent's code 
+            try {
+              close(fds[0]); 
+              Outcome outcome = simulate(sim, world, candidates[next], seeds[next], tolerance); 
+              bool ok = write(fds[1], &outcome, sizeof(outcome)) == (ssize_t)sizeof(outcome); 
+              _exit(ok ? 0 : 1); 
+            } catch (...){
+              _exit(1); 
+            }
+          }
+          close(fds[1]); 
+          running[pid] = make_pair(next++, fds[0]); 
+          continue; 
+        }
+        if (running.empty()){ break; }
+        int status; 
+        pid_t pid = wait(&status); 
+        if (pid < 0){ throw "Lost the calibration runs!"; }
+        auto child = running.find(pid); 
+        if (child == running.end()){ continue; }
+        Outcome& outcome = outcomes[child->second.first]; 
+        bool ok = WIFEXITED(status) && WEXITSTATUS(status) == 0 && 
+                  read(child->second.second, &outcome, sizeof(outcome)) == (ssize_t)sizeof(outcome); 
+        close(child->second.second); 
+        running.erase(child); 
+        failed = failed || !ok; 
+      }
+      if (failed){
+        cerr << "A calibration run exited without its outcome" << endl; 
+        throw "Calibration run failed!"; 
+      }
+      return outcomes; 
+    }
+}; 
+
+/*
+ * Benchmark harness: one RANDOM location of n agents for the given ticks. 
+ * Run one storage mode per process, peak RSS covers the whole process. 
+*/
+void benchmark(PopulationSize n, int ticks, bool compact){
+  auto start = chrono::steady_clock::now(); 
+  Location loc(RANDOM, n - n / 1000, n / 1000, 
+               MixedAge{make_pair(1, age_by_location.find(RANDOM)->second)}, NPI()); 
+  loc.compact = compact; 
+  loc.init(0); 
+  double build_seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count(); 
+
+  start = chrono::steady_clock::now(); 
+  for (int t = 1; t <= ticks; ++t){
+    loc.run(t); 
+  }
+  double run_seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count(); 
+
+  struct rusage usage; 
+  getrusage(RUSAGE_SELF, &usage); 
+  cout << "agents " << n << (compact ? " compact" : " person") 
+       << " build_ms " << build_seconds * 1000 
+       << " ms_per_tick " << run_seconds * 1000 / max(ticks, 1) 
+       << " peak_rss_mb " << usage.ru_maxrss / 1024.0 
+       << " bytes_per_agent " << usage.ru_maxrss * 1024.0 / n << endl; 
+}
+
+/*
+ * Rare-event driver: the chance that the number of agents in `state` reaches 
+ * the last level before the scenario ends, by multilevel splitting from the 
+ * state the scenario starts in. Branches always use compact storage. 
+*/
+void splitRun(const char* path, int effort, const string& state, const vector<double>& levels){
+  Scenario scenario; 
+  scenario.load(path); 
+  scenario.compact = true; 
+  scenario.dropOutputs(); 
+  int target = -1; 
+  for (int s = SUSCEPTIBLE; s <= DECEASED; ++s){
+    if (state == SEIHCRD[s]){ target = s; }
+  }
+  if (target < 0){
+    cerr << "Unknown state " << state << endl; 
+    throw "Invalid state!"; 
+  }
+  auto start = chrono::steady_clock::now(); 
+  Branch root(scenario.simulation(), WorldImage::build(scenario), generator()); 
+  Splitting splitting(levels, effort, [target](Branch& b){ return (double) b.count(static_cast<enum SEIHCRD>(target)); }); 
+  double estimate = splitting.run(root, generator()); 
+  double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count(); 
+  double reached = 1; 
+  for (size_t l = 0; l < levels.size(); ++l){
+    reached *= splitting.conditional[l]; 
+    cout << state << " >= " << levels[l] << " " << splitting.conditional[l] << " " << reached << endl; 
+  }
+  cout << "estimate " << estimate << " forks " << splitting.forks << " ticks " << splitting.ticks 
+       << " seconds " << seconds << endl; 
+}
+
+/*
+ * Calibration driver: ABC-SMC of the scenario's `calibrate` parameters against 
+ * its `observe` data, over one world built (or mapped) before the first run. 
+*/
+void calibrateRun(const char* path){
+  Scenario scenario; 
+  scenario.load(path); 
+  scenario.dropOutputs(); 
+  auto start = chrono::steady_clock::now(); 
+  Calibration calibration(scenario); 
+  vector<Location> world = WorldImage::build(scenario); 
+  calibration.run(scenario.simulation(), world, generator()); 
+  double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count(); 
+  for (size_t g = 0; g < calibration.tolerances.size(); ++g){
+    cout << "generation " << g << " tolerance " << calibration.tolerances[g] 
+         << " proposals " << calibration.proposals[g] << endl; 
+  }
+  for (size_t k = 0; k < calibration.priors.size(); ++k){
+    cout << calibration.priors[k].name() << " mean " << calibration.mean(k) 
+         << " sd " << sqrt(calibration.variance(k)) << endl; 
+  }
+  cout << "runs " << calibration.runs << " aborted " << calibration.aborted << " ticks " << calibration.ticks 
+       << " of " << calibration.full_ticks << " seconds " << seconds << endl; 
+}
+
+/*
+ * History query: the status changes of some agents of one location, one agent 
+ * per line as `agent tick:STATE ...`, from the blocks that hold them only. 
+*/
+void printHistory(const char* path, uint32_t location, const vector<uint32_t>& agents){
+  unique_ptr<HistoryReader> reader(HistoryReader::open(path)); 
+  map<uint32_t, vector<StateEvent>> trajectories; 
+  if (!reader || !reader->cohort(location, agents, trajectories)){
+    cerr << "Cannot read history " << path << endl; 
+    throw "Invalid history!"; 
+  }
+  for (auto agent: agents){
+    cout << agent; 
+    for (auto &e: trajectories[agent]){
+      cout << " " << e.tick << ":" << SEIHCRD[e.state]; 
+    }
+    cout << endl; 
+  }
+  cerr << "blocks read " << reader->blocks_read << " of " << reader->blocks() << endl; 
+}
+
+int main(int argc, char** argv){
+  if (argc > 2 && string(argv[1]) == "bench"){
+    int ticks = argc > 3 ? atoi(argv[3]) : 24; 
+    benchmark(atoll(argv[2]), ticks, argc > 4 && string(argv[4]) == "compact"); 
+    return 0; 
+  }
+  if (argc > 3 && string(argv[1]) == "population"){
+    try {
+      auto start = chrono::steady_clock::now(); 
+      PopulationSize agents = PopulationFile::convert(argv[2], argv[3]); 
+      cout << "agents " << agents << " locations " << PopulationFile::locations(argv[3]) << " seconds " 
+           << chrono::duration<double>(chrono::steady_clock::now() - start).count() << endl; 
+    } catch (const char* msg){
+      cerr << msg << endl; 
+      return 1; 
+    }
+    return 0; 
+  }
+  if (argc > 5 && string(argv[1]) == "split"){
+    try {
+      vector<double> levels; 
+      for (int a = 5; a < argc; ++a){
+        levels.push_back(atof(argv[a])); 
+      }
+      splitRun(argv[2], atoi(argv[3]), argv[4], levels); 
+    } catch (const char* msg){
+      cerr << msg << endl; 
+      return 1; 
+    }
+    return 0; 
+  }
+  if (argc > 4 && string(argv[1]) == "history"){
+    try {
+      vector<uint32_t> agents; 
+      for (int a = 4; a < argc; ++a){
+        agents.push_back(atoll(argv[a])); 
+      }
+      printHistory(argv[2], atoll(argv[3]), agents); 
+    } catch (const char* msg){
+      cerr << msg << endl; 
+      return 1; 
+    }
+    return 0; 
+  }
+  if (argc > 2 && string(argv[1]) == "calibrate"){
+    try {
+      calibrateRun(argv[2]); 
+    } catch (const char* msg){
+      cerr << msg << endl; 
+      return 1; 
+    }
+    return 0; 
+  }
+  if (argc > 1){
+    try {
+      Scenario scenario; 
+      scenario.load(argv[1]); 
+      scenario.simulation().start(WorldImage::build(scenario)); 
+    } catch (const char* msg){
+      cerr << msg << endl; 
+      return 1; 
+    }
+    return 0; 
+  }
+  // testHistory(); 
+  // testCalibration(); 
+  // testPopulationFile(); 
+  // testSplitting(); 
+  // testTravel(); 
+  // testVaccination(); 
+  // testTracing(); 
+  // testInfections(); 
+  // testCompact(); 
+  // testAgeMixing(); 
+  // testHospital(); 
+  // testConcurrentContacts(); 
+  // testMetrics(); 
+  // testScenario(); 
+  // testPerson(); 
+  testSimulation(); 
+  // testInfectiousness(); 
+  // testPolicy(); 
+  return 0; 
+}
+
+void testPerson(){
   SEIHCRD_Transitions* state1 = new SEIHCRD_Transitions(HOME, SUSCEPTIBLE, 1); 
   SEIHCRD_Transitions* state2 = new SEIHCRD_Transitions(HOME, INFECTIOUS, 1); 
   Person person1(state1);
@@ -597,3 +3799,880 @@ void testPolicy(){
 
   cout << "Tests for TransmissionProb passed\n"; 
 }
+
+void testScenario(){
+  Scenario scenario; 
+  scenario.parse(
+    "# two fixed locations and three generated ones\n"
+    "simulation 0 20 1 10\n"
+    "cache /tmp/epidemic_test_cache\n"
+    "compact off\n"
+    "location HOME 500 5 0.5:30:10 0.5:70:10\n"
+    "policy 0 0.75 0.75 0.75 0.7\n"
+    "generate RANDOM 3 300 10 1 0.01\n"); 
+  assert(scenario.end_time == 20 && scenario.report_interval == 10); 
+  assert(scenario.specs.size() == 2); 
+  assert(scenario.specs[0].age_description.size() == 2); 
+  assert(scenario.specs[1].generated && scenario.specs[1].count == 3); 
+  assert(abs(scenario.specs[1].policy.compliance_rate - 0.7) < 1e-9); 
+  // a simulation line that cannot run is rejected 
+  for (const char* bad: {"simulation 0 10 1 0\n", "simulation 0 10 0 1\n", "simulation 10 0 1 1\n"}){
+    Scenario invalid; 
+    bool threw = false; 
+    try {
+      invalid.parse(bad); 
+    } catch (const char*){
+      threw = true; 
+    }
+    assert(threw); 
+  }
+  // cached worlds are compact unless asked otherwise 
+  Scenario cached, uncached; 
+  cached.parse("location HOME 10 1\n"); 
+  uncached.parse("cache off\nlocation HOME 10 1\n"); 
+  assert(!scenario.compact && cached.compact && !uncached.compact); 
+
+  vector<Location> first = WorldImage::build(scenario); 
+  vector<Location> second = WorldImage::build(scenario); 
+  assert(first.size() == 4 && second.size() == 4); 
+  for (size_t i = 0; i < first.size(); ++i){
+    const vector<Person>& a = first[i].getPopulation(); 
+    const vector<Person>& b = second[i].getPopulation(); 
+    assert(a.size() == b.size() && first[i].initial_seed == second[i].initial_seed); 
+    for (size_t j = 0; j < a.size(); ++j){
+      assert(a[j].age == b[j].age && a[j].symptomatic == b[j].symptomatic); 
+      assert(a[j].state->health_status == b[j].state->health_status); 
+    }
+  }
+  scenario.simulation().start(second); 
+
+  // an image of another model is regenerated, not restored 
+  char name[64]; 
+  snprintf(name, sizeof(name), "/tmp/epidemic_test_cache/%016llx.world", scenario.hash); 
+  FILE* image = fopen(name, "r+b"); 
+  assert(image != nullptr); 
+  unsigned long long version; 
+  fseek(image, 16, SEEK_SET); 
+  assert(fread(&version, sizeof(version), 1, image) == 1); 
+  unsigned long long other = version + 1; 
+  fseek(image, 16, SEEK_SET); 
+  fwrite(&other, sizeof(other), 1, image); 
+  fclose(image); 
+  vector<Location> third = WorldImage::build(scenario); 
+  assert(third.size() == 4); 
+  image = fopen(name, "rb"); 
+  fseek(image, 16, SEEK_SET); 
+  assert(fread(&other, sizeof(other), 1, image) == 1 && other == version); 
+  fclose(image); 
+
+  cout << "Tests for Scenario passed\n"; 
+}
+
+void testMetrics(){
+  string name = "/epidemic_test_metrics"; 
+  LiveMetrics* writer = LiveMetrics::create(name); 
+  LiveMetrics* reader = LiveMetrics::attach(name); 
+  assert(writer != nullptr && reader != nullptr); 
+
+  MetricsSample sample; 
+  assert(!reader->latest(sample)); 
+
+  NPI no_intervention; 
+  Simulation sim(0, 300, 1, 100); 
+  sim.metrics = writer; 
+  sim.start(vector<Location>{Location(RANDOM, 1000, 10, MixedAge{make_pair(1, AgeInfo(40, 10))}, no_intervention)}); 
+
+  // one sample per tick, the ring keeps the most recent ones 
+  assert(reader->published() == 300); 
+  assert(reader->latest(sample) && sample.tick == 299 && sample.end_tick == 300); 
+  assert(accumulate(sample.counts, sample.counts + METRICS_STATES, 0LL) == 1010); 
+  assert(!reader->read(0, sample)); 
+  assert(reader->read(300 - METRICS_RING_SIZE, sample) && sample.tick == 300 - METRICS_RING_SIZE); 
+
+  writer->unlink(); 
+  delete reader; 
+  delete writer; 
+  cout << "Tests for LiveMetrics passed\n"; 
+}
+
+void testConcurrentContacts(){
+  NPI no_intervention; 
+  PopulationSize size = 20000; 
+  auto build = [size, no_intervention](){
+    vector<Person> population; 
+    for (PopulationSize i = 0; i < size; ++i){
+      enum SEIHCRD status = (i % 10 == 0) ? INFECTIOUS : SUSCEPTIBLE; 
+      population.push_back(Person(new SEIHCRD_Transitions(RANDOM, status, 0), i % 90, i % 3 != 0, false)); 
+    }
+    return Location(RANDOM, population, MixedAge{make_pair(1, AgeInfo(40, 10))}, no_intervention); 
+  }; 
+
+  // same seed, different thread counts -> same trajectories 
+  vector<int> thread_counts {2, 3, 7}; 
+  vector<vector<enum SEIHCRD>> outcomes; 
+  for (auto t: thread_counts){
+    Location loc = build(); 
+    loc.threads = t; 
+    loc.concurrent_min_contacts = 0; 
+    generator.seed(2020); 
+    for (timestamp ts = 1; ts < 80; ++ts){
+      loc.run(ts); 
+    }
+    vector<enum SEIHCRD> states; 
+    for (auto &p: loc.getPopulation()){
+      states.push_back(p.state->health_status); 
+    }
+    outcomes.push_back(states); 
+  }
+  assert(outcomes[0] == outcomes[1] && outcomes[1] == outcomes[2]); 
+  assert(count(outcomes[0].begin(), outcomes[0].end(), SUSCEPTIBLE) < size - size/10); 
+
+  cout << "Tests for concurrent contacts passed\n"; 
+}
+
+void testHospital(){
+  NPI no_intervention; 
+  // two locations, each with 10 critical and 8 hospitalized agents 
+  vector<Location> locations; 
+  for (int l = 0; l < 2; ++l){
+    vector<Person> population; 
+    for (int i = 0; i < 18; ++i){
+      enum SEIHCRD status = i < 10 ? CRITICAL : HOSPITALIZED; 
+      population.push_back(Person(new SEIHCRD_Transitions(HOSPITAL, status, 0), 70, true, false)); 
+    }
+    locations.push_back(Location(RANDOM, population, MixedAge{make_pair(1, AgeInfo(70, 5))}, no_intervention)); 
+    locations.back().care_tracking = true; 
+  }
+
+  HospitalSystem hospital(6, 5); 
+  for (auto &loc: locations){
+    loc.run(1); 
+  }
+  hospital.admit(locations); 
+  assert(hospital.icu_in_use == 5 && hospital.waitingForICU() == 15); 
+  assert(hospital.beds_in_use == 6 && hospital.waitingForBed() == 10); 
+  // first come first served: the first location's agents got the beds 
+  assert(!locations[0].isWaiting(10, WAITING_BED) && locations[0].isWaiting(17, WAITING_BED)); 
+  assert(locations[1].isWaiting(10, WAITING_BED)); 
+  // a late admission keeps the stay untreated 
+  assert(!locations[0].waited(10) && locations[1].waited(10)); 
+
+  // everyone is discharged by DECIDE_CRITICAL + ICU_DAYS, beds are returned 
+  for (timestamp ts = 2; ts <= DECIDE_CRITICAL + ICU_DAYS + 1; ++ts){
+    for (auto &loc: locations){
+      loc.run(ts); 
+    }
+    hospital.admit(locations); 
+  }
+  assert(hospital.beds_in_use == 0 && hospital.icu_in_use == 0); 
+  assert(hospital.waitingForBed() == 0 && hospital.waitingForICU() == 0); 
+  // leaving care clears the flag with the rest of the care state 
+  for (auto &loc: locations){
+    for (PopulationSize i = 0; i < 18; ++i){
+      assert(!loc.waited(i) && !loc.isWaiting(i, WAITING_BED)); 
+    }
+  }
+
+  cout << "Tests for HospitalSystem passed\n"; 
+}
+
+void testAgeMixing(){
+  mt19937 gen(7); 
+  AliasTable table(vector<double>{1, 2, 3, 4}); 
+  vector<int> hits(4, 0); 
+  int draws = 100000; 
+  for (int i = 0; i < draws; ++i){
+    ++hits[table.sample(gen)]; 
+  }
+  for (int i = 0; i < 4; ++i){
+    assert(abs(1.0 * hits[i] / draws - (i + 1) / 10.0) < 0.01); 
+  }
+
+  // 1000 children (group 0) and 1000 people in their seventies (group 7) 
+  vector<uint8_t> groups; 
+  for (int i = 0; i < 2000; ++i){
+    groups.push_back(i < 1000 ? 0 : 7); 
+  }
+  AgeMixing mixing(groups); 
+  assert(mixing.groupSize(0) == 1000 && mixing.groupSize(7) == 1000); 
+
+  // children only meet children 
+  ContactMatrix children_only(AGE_GROUPS, vector<double>(AGE_GROUPS, 0)); 
+  children_only[0][0] = 1; 
+  mixing.setMatrix(children_only, vector<double>(AGE_GROUPS, 1)); 
+  for (int i = 0; i < 1000; ++i){
+    PopulationSize a, b; 
+    mixing.draw(gen, a, b); 
+    assert(groups[a] == 0 && groups[b] == 0); 
+  }
+
+  // shielding group 7 removes its contacts without touching the population 
+  NPI shield; 
+  shield.age_group_contact_scale[7] = 0; 
+  mixing.setMatrix(defaultContactMatrix(RANDOM), shield.age_group_contact_scale); 
+  assert(mixing.contact_scale > 0 && mixing.contact_scale < 1); 
+  for (int i = 0; i < 1000; ++i){
+    PopulationSize a, b; 
+    mixing.draw(gen, a, b); 
+    assert(groups[a] == 0 && groups[b] == 0); 
+  }
+
+  cout << "Tests for age mixing passed\n"; 
+}
+
+void testCompact(){
+  // bit fields round-trip and the entry tick wraps at 16 bits 
+  timestamp ts = 3 * 65536 + 100; 
+  CompactAgent agent(WORK, EXPOSED, 8, true, true, ts); 
+  assert(agent.status() == EXPOSED && agent.atLocation() == WORK && agent.ageGroup() == 8); 
+  assert(agent.isSymptomatic() && agent.isIsolate()); 
+  assert(agent.enteredAt(ts + 5000) == ts); 
+  agent.transit(CRITICAL, ts + 70000); 
+  assert(agent.status() == CRITICAL && agent.atLocation() == HOSPITAL && agent.enteredAt(ts + 70010) == ts + 70000); 
+  assert(sizeof(CompactAgent) == 4); 
+
+  // both storages run the same epidemic, compact only rounds ages to groups 
+  for (int compact = 0; compact < 2; ++compact){
+    Location loc(HOME, 4900, 100, MixedAge{make_pair(1, AgeInfo(40, 20))}, NPI()); 
+    loc.compact = compact; 
+    loc.init(0); 
+    assert(loc.stored() == 5000); 
+    for (timestamp ts = 1; ts < 60 * DAY; ++ts){
+      loc.run(ts); 
+    }
+    Summary summary = loc.report(); 
+    PopulationSize total = 0; 
+    for (auto s: summary){
+      total += s.second; 
+    }
+    assert(total == 5000); 
+    assert(summary[SUSCEPTIBLE] < 4900 && summary[RECOVERED] > 100); 
+  }
+
+  cout << "Tests for compact agents passed\n"; 
+}
+
+void testInfections(){
+  // 10 roots infect 2 each 5 ticks later, who infect 2 each 5 ticks after that 
+  ReproductionEstimator tree; 
+  for (int i = 0; i < 10; ++i){
+    tree.add(InfectionEvent{0, -1, 0, NO_INFECTOR, 0}); 
+  }
+  for (int i = 0; i < 20; ++i){
+    tree.add(InfectionEvent{5, 0, 0, 0, 0}); 
+  }
+  for (int i = 0; i < 40; ++i){
+    tree.add(InfectionEvent{10, 5, 0, 0, 0}); 
+  }
+  assert(tree.caseRt(0, 1) == 2 && tree.caseRt(5, 6) == 2 && tree.caseRt(10, 11) == 0); 
+  assert(tree.meanGenerationInterval() == 5 && tree.generationDistribution()[5] == 1); 
+  assert(abs(tree.instantaneousRt(10, 11) - 2) < 1e-9 && tree.infections(0, 11) == 70); 
+
+  // every infection has exactly one infector, infected before it 
+  auto simulate = [](int threads){
+    Location loc(HOME, 19800, 200, MixedAge{make_pair(1, AgeInfo(40, 20))}, NPI()); 
+    loc.threads = threads; 
+    loc.concurrent_min_contacts = 0; 
+    loc.track_infections = true; 
+    generator.seed(33); 
+    loc.init(0); 
+    vector<InfectionEvent> events; 
+    for (timestamp ts = 1; ts < 40 * DAY; ++ts){
+      loc.run(ts); 
+      events.insert(events.end(), loc.newInfections().begin(), loc.newInfections().end()); 
+      loc.newInfections().clear(); 
+    }
+    Summary summary = loc.report(); 
+    assert((PopulationSize)events.size() == 20000 - summary[SUSCEPTIBLE]); 
+    vector<timestamp> infected(20000, -2); 
+    for (auto &e: events){
+      assert(infected[e.infectee] == -2); 
+      infected[e.infectee] = e.tick; 
+      if (e.infector != NO_INFECTOR){
+        assert(infected[e.infector] == e.infector_tick && e.infector_tick < e.tick); 
+      }
+    }
+    return events; 
+  }; 
+  vector<InfectionEvent> serial = simulate(1); 
+  assert(serial.size() > 1000); 
+  // deterministic across thread counts 
+  assert(simulate(2) == simulate(3)); 
+
+  // both file formats read back the same events 
+  for (int compressed = 0; compressed < 2; ++compressed){
+    string path = "/tmp/test_infections.log"; 
+    InfectionLog* log = InfectionLog::create(path, compressed); 
+    assert(log != nullptr); 
+    vector<InfectionEvent> events = serial; 
+    log->append(3, events); 
+    delete log; 
+    vector<InfectionEvent> read; 
+    assert(InfectionLog::read(path, read) && read == events); 
+    remove(path.c_str()); 
+    remove((path + ".rt").c_str()); 
+  }
+
+  cout << "Tests for infection events passed\n"; 
+}
+
+void testTracing(){
+  // the ring keeps the last CONTACT_HISTORY contacts 
+  ContactHistory history; 
+  history.reset(2); 
+  for (int t = 0; t < CONTACT_HISTORY + 3; ++t){
+    history.add(1, 100 + t, t); 
+  }
+  vector<PopulationSize> seen; 
+  history.forEach(1, 0, [&](PopulationSize other){ seen.push_back(other); }); 
+  sort(seen.begin(), seen.end()); 
+  assert(seen.size() == CONTACT_HISTORY && seen.front() == 103 && seen.back() == 100 + CONTACT_HISTORY + 2); 
+  seen.clear(); 
+  history.forEach(1, CONTACT_HISTORY + 1, [&](PopulationSize other){ seen.push_back(other); }); 
+  assert(seen.size() == 2); 
+  history.forEach(0, 0, [&](PopulationSize){ assert(false); }); 
+
+  auto epidemic = [](PopulationSize daily_tests, int threads, TestingSystem& testing){
+    vector<Location> locations; 
+    locations.push_back(Location(WORK, 19800, 200, MixedAge{make_pair(1, AgeInfo(40, 20))}, NPI())); 
+    locations[0].tracing = daily_tests > 0; 
+    locations[0].threads = threads; 
+    locations[0].concurrent_min_contacts = 0; 
+    generator.seed(34); 
+    locations[0].init(0); 
+    for (timestamp ts = 1; ts < 60 * DAY; ++ts){
+      locations[0].run(ts); 
+      if (daily_tests > 0){
+        testing.run(locations, ts); 
+      }
+    }
+    return locations[0].report()[SUSCEPTIBLE]; 
+  }; 
+
+  TestingSystem none(0), scarce(20), ample(2000); 
+  PopulationSize untraced = epidemic(0, 1, none); 
+  PopulationSize few_tests = epidemic(20, 1, scarce); 
+  PopulationSize traced = epidemic(2000, 1, ample); 
+  // capacity is a hard daily limit 
+  assert(scarce.tests_done <= 20 * 60 && scarce.waitingForTest() > 0); 
+  assert(ample.positive_tests > 0 && ample.traced_contacts > 0); 
+  // quarantine removes contacts, so more people stay susceptible 
+  assert(untraced < traced && few_tests < traced); 
+
+  // contact history is merged in contact order, independent of the thread count 
+  TestingSystem two(2000), three(2000); 
+  assert(epidemic(2000, 2, two) == epidemic(2000, 3, three)); 
+  assert(two.tests_done == three.tests_done && two.traced_contacts == three.traced_contacts); 
+
+  cout << "Tests for test, trace and isolate passed\n"; 
+}
+
+void testVaccination(){
+  // two locations of 1000 people in their seventies and 1000 in their thirties 
+  auto build = [](){
+    vector<Location> locations; 
+    for (int l = 0; l < 2; ++l){
+      vector<Person> population; 
+      for (int i = 0; i < 2000; ++i){
+        population.push_back(Person(new SEIHCRD_Transitions(WORK, SUSCEPTIBLE, 0), i % 2 ? 75 : 35, true, false)); 
+      }
+      locations.push_back(Location(WORK, population, MixedAge{make_pair(1, AgeInfo(50, 20))}, NPI())); 
+      locations.back().vaccination = true; 
+      locations.back().vaccine = Vaccine(1, 1); 
+      locations.back().run(0); 
+    }
+    return locations; 
+  }; 
+
+  // nothing before the start day, then 1500 doses a day, oldest first, split evenly 
+  vector<Location> locations = build(); 
+  VaccinationCampaign campaign(1500, 2 * DAY, Vaccine(1, 1), vector<int>{7, 3}); 
+  campaign.run(locations, DAY); 
+  assert(campaign.doses_given == 0); 
+  campaign.run(locations, 2 * DAY); 
+  assert(campaign.doses_given == 1500); 
+  assert(locations[0].unvaccinated(7) == 250 && locations[1].unvaccinated(7) == 250); 
+  for (auto &loc: locations){
+    for (PopulationSize i = 0; i < 2000; ++i){
+      assert(!loc.isVaccinated(i) || loc.getPopulation()[i].age == 75); 
+    }
+  }
+  campaign.run(locations, 3 * DAY); 
+  assert(locations[0].unvaccinated(7) + locations[1].unvaccinated(7) == 0); 
+  assert(locations[0].unvaccinated(3) + locations[1].unvaccinated(3) == 1000); 
+  campaign.run(locations, 4 * DAY); 
+  campaign.run(locations, 5 * DAY); 
+  assert(campaign.doses_given == 4000); 
+
+  // a perfect vaccine keeps its recipients susceptible through an outbreak 
+  // seeded among the young 
+  vector<Person> population; 
+  for (int i = 0; i < 2000; ++i){
+    enum SEIHCRD status = (i % 50 == 0) ? EXPOSED : SUSCEPTIBLE; 
+    population.push_back(Person(new SEIHCRD_Transitions(WORK, status, 0), i % 2 ? 75 : 35, true, false)); 
+  }
+  Location loc(WORK, population, MixedAge{make_pair(1, AgeInfo(50, 20))}, NPI()); 
+  loc.vaccination = true; 
+  loc.vaccine = Vaccine(1, 1); 
+  loc.run(1); 
+  assert(loc.vaccinate(7, 5000) == 1000); 
+  for (timestamp ts = 2; ts < 60 * DAY; ++ts){
+    loc.run(ts); 
+  }
+  PopulationSize infected_young = 0; 
+  for (PopulationSize i = 0; i < 2000; ++i){
+    if (loc.getPopulation()[i].age == 75){
+      assert(loc.agentStatus(i) == SUSCEPTIBLE); 
+    } else if (loc.agentStatus(i) != SUSCEPTIBLE){
+      ++infected_young; 
+    }
+  }
+  assert(infected_young > 40); 
+
+  // doses go to the susceptible only, in a random order within the group 
+  population.clear(); 
+  for (int i = 0; i < 2000; ++i){
+    enum SEIHCRD status = (i % 4 == 1) ? EXPOSED : SUSCEPTIBLE; 
+    population.push_back(Person(new SEIHCRD_Transitions(WORK, status, 0), i % 2 ? 75 : 35, true, false)); 
+  }
+  Location mixed(WORK, population, MixedAge{make_pair(1, AgeInfo(50, 20))}, NPI()); 
+  mixed.vaccination = true; 
+  mixed.vaccine = Vaccine(1, 1); 
+  mixed.run(1); 
+  assert(mixed.vaccinate(7, 250) == 250 && mixed.unvaccinated(7) > 0); 
+  PopulationSize late = 0; 
+  for (PopulationSize i = 0; i < 2000; ++i){
+    assert(!mixed.isVaccinated(i) || mixed.agentStatus(i) == SUSCEPTIBLE); 
+    late += mixed.isVaccinated(i) && i >= 1000; 
+  }
+  assert(late > 50); 
+  assert(mixed.vaccinate(7, 5000) == 250 && mixed.unvaccinated(7) == 0); 
+
+  cout << "Tests for vaccination passed\n"; 
+}
+
+void testTravel(){
+  TravelMatrix csr(3, vector<tuple<uint32_t, uint32_t, double>>{
+    make_tuple(2, 0, 0.1), make_tuple(0, 1, 0.2), make_tuple(0, 2, 0.3)}); 
+  assert(csr.edges() == 3); 
+
+  // seeded in location 0 only, location 1 is reached through travel alone 
+  auto epidemic = [](TravelMatrix* travel){
+    vector<Location> locations; 
+    locations.push_back(Location(HOME, 4950, 50, MixedAge{make_pair(1, AgeInfo(40, 20))}, NPI())); 
+    locations.push_back(Location(HOME, 5000, 0, MixedAge{make_pair(1, AgeInfo(40, 20))}, NPI())); 
+    generator.seed(36); 
+    for (auto &loc: locations){
+      loc.init(0); 
+    }
+    for (timestamp ts = 1; ts < 60 * DAY; ++ts){
+      if (travel != nullptr){
+        vector<PopulationSize> imports = travel->couple(locations); 
+        for (size_t l = 0; l < locations.size(); ++l){
+          locations[l].imported_exposures = imports[l]; 
+        }
+      }
+      for (auto &loc: locations){
+        loc.run(ts); 
+      }
+    }
+    return locations[1].report()[SUSCEPTIBLE]; 
+  }; 
+  TravelMatrix route(2, vector<tuple<uint32_t, uint32_t, double>>{make_tuple(0, 1, 0.05)}); 
+  assert(epidemic(nullptr) == 5000); 
+  assert(epidemic(&route) < 4900); 
+
+  // with 1% susceptible most rejection draws miss, every susceptible is still 
+  // reached and only the imports beyond them are dropped 
+  vector<Person> few; 
+  for (int i = 0; i < 1000; ++i){
+    enum SEIHCRD status = (i % 100 == 0) ? SUSCEPTIBLE : RECOVERED; 
+    few.push_back(Person(new SEIHCRD_Transitions(RANDOM, status, 0), 40, false, false)); 
+  }
+  Location scarce(RANDOM, few, MixedAge{make_pair(1, AgeInfo(40, 20))}, NPI()); 
+  scarce.run(0); 
+  scarce.imported_exposures = 25; 
+  scarce.run(1); 
+  assert(scarce.count(SUSCEPTIBLE) == 0 && scarce.dropped_imports == 15); 
+
+  // imports only depend on the seed, not on the threads over the edge blocks 
+  vector<Location> locations; 
+  for (int l = 0; l < 250; ++l){
+    vector<Person> population; 
+    for (int i = 0; i < 100; ++i){
+      enum SEIHCRD status = (i < l % 7) ? INFECTIOUS : SUSCEPTIBLE; 
+      population.push_back(Person(new SEIHCRD_Transitions(RANDOM, status, 0), 40, false, false)); 
+    }
+    locations.push_back(Location(RANDOM, population, MixedAge{make_pair(1, AgeInfo(40, 20))}, NPI())); 
+    locations.back().run(0); 
+  }
+  TravelMatrix dense(250, TravelMatrix::randomEdges(250, 150, 0.01, generator)); 
+  assert(dense.edges() > 2 * TRAVEL_BLOCK); 
+  // no origin sends twice to one destination, and degree is capped at the others 
+  vector<tuple<uint32_t, uint32_t, double>> edges = TravelMatrix::randomEdges(250, 150, 0.01, generator); 
+  sort(edges.begin(), edges.end()); 
+  assert(edges.size() == 250 * 150 && adjacent_find(edges.begin(), edges.end()) == edges.end()); 
+  assert(TravelMatrix::randomEdges(5, 10, 0.01, generator).size() == 5 * 4); 
+  vector<vector<PopulationSize>> imports; 
+  for (int threads = 1; threads <= 4; threads += 3){
+    dense.threads = threads; 
+    generator.seed(360); 
+    imports.push_back(dense.couple(locations)); 
+  }
+  assert(imports[0] == imports[1]); 
+  assert(accumulate(imports[0].begin(), imports[0].end(), (PopulationSize)0) > 0); 
+
+  cout << "Tests for travel passed\n"; 
+}
+
+void testSplitting(){
+  // copies share pages until one of them writes a different value 
+  CowVector<uint8_t> a; 
+  a.assign(3 * COW_PAGE, 1); 
+  CowVector<uint8_t> b = a; 
+  assert(a.ownedPages() == 0); 
+  b.set(COW_PAGE + 5, 2); 
+  b.set(0, 1); 
+  assert(a[COW_PAGE + 5] == 1 && b[COW_PAGE + 5] == 2); 
+  assert(a.ownedPages() == 1 && b.ownedPages() == 1); 
+  // and so do copies of a contact history, one page per column at a time 
+  ContactHistory h; 
+  h.reset(4 * COW_PAGE); 
+  ContactHistory g = h; 
+  assert(g.ownedPages() == 0); 
+  g.add(5, 7, 1); 
+  assert(g.ownedPages() == 3 && h.ownedPages() == 3 && g.pageCount() == 2 * CONTACT_HISTORY * 4 + 4); 
+
+  bool threw = false; 
+  try {
+    Branch person(Simulation(), vector<Location>{Location(HOME, 100, 1, MixedAge{make_pair(1, AgeInfo(50, 20))}, NPI())}, 1); 
+  } catch (const char*){
+    threw = true; 
+  }
+  assert(threw); 
+
+  // forks of one state with one seed follow one trajectory and leave the 
+  // state they came from alone; a fresh fork only holds pages it wrote 
+  Simulation sim(0, 40 * DAY, 1, DAY); 
+  vector<Location> locations; 
+  locations.push_back(Location(HOME, 99900, 100, MixedAge{make_pair(1, AgeInfo(50, 20))}, NPI())); 
+  locations.back().compact = true; 
+  Branch root(sim, locations, 37); 
+  for (int t = 0; t < 10 * DAY; ++t){
+    root.step(); 
+  }
+  auto counts = [](Branch& branch){
+    vector<PopulationSize> ans; 
+    for (int s = SUSCEPTIBLE; s <= DECEASED; ++s){
+      ans.push_back(branch.count(static_cast<enum SEIHCRD>(s))); 
+    }
+    return ans; 
+  }; 
+  vector<PopulationSize> at_fork = counts(root); 
+  unique_ptr<Branch> same = root.fork(1), again = root.fork(1), other = root.fork(2); 
+  assert(same->ownedPages() == 0); 
+  same->step(); 
+  // early on few agents change, so few of the agent and next state pages split 
+  assert(same->ownedPages() > 0 && same->ownedPages() < same->pageCount() / 3); 
+  for (int t = 1; t < 10 * DAY; ++t){
+    same->step(); 
+  }
+  for (int t = 0; t < 10 * DAY; ++t){
+    again->step(); 
+    other->step(); 
+  }
+  assert(counts(*same) == counts(*again)); 
+  assert(counts(*same) != counts(*other)); 
+  assert(counts(root) == at_fork && root.now == 10 * DAY); 
+
+  // mid-epidemic some agent of every page changes each tick, but a fork still 
+  // leaves the pages of the state buffer it reads alone 
+  while (root.now < 30 * DAY){
+    root.step(); 
+  }
+  assert(root.count(EXPOSED) + root.count(INFECTIOUS) > 2000); 
+  unique_ptr<Branch> peak = root.fork(3); 
+  peak->step(); 
+  assert(peak->ownedPages() > 0 && peak->ownedPages() <= 2 * peak->pageCount() / 3); 
+
+  // splitting is reproducible and its estimate the product of the stages 
+  Simulation small(0, 40 * DAY, 1, DAY); 
+  vector<Location> town; 
+  town.push_back(Location(HOME, 1995, 5, MixedAge{make_pair(1, AgeInfo(50, 20))}, NPI())); 
+  town.back().compact = true; 
+  Branch start(small, town, 7); 
+  Splitting splitting(vector<double>{60, 150, 300}, 16, [](Branch& branch){ return (double) branch.count(INFECTIOUS); }); 
+  double estimate = splitting.run(start, 3); 
+  double product = 1; 
+  for (auto p: splitting.conditional){
+    product *= p; 
+  }
+  assert(splitting.conditional.size() == 3 && estimate == product); 
+  assert(estimate > 0 && estimate <= 1); 
+  assert(splitting.forks == 48); 
+  assert(splitting.run(start, 3) == estimate); 
+
+  cout << "Tests for splitting passed\n"; 
+}
+
+void testPopulationFile(){
+  string csv = "/tmp/test_population.csv"; 
+  string path = "/tmp/test_population.pop"; 
+  FILE* out = fopen(csv.c_str(), "w"); 
+  fprintf(out, "location,type,age,exposed\n"); 
+  for (int i = 0; i < 10000; ++i){
+    fprintf(out, "%d,%s,%d,%d\r\n", i % 2, (i % 2) ? "WORK" : "HOME", i % 90, i % 500 == 0); 
+  }
+  fprintf(out, "1,WORK,45"); 
+  fclose(out); 
+  assert(PopulationFile::convert(csv, path) == 10001); 
+  assert(PopulationFile::locations(path) == 2); 
+
+  // columns in row order, ages rounded to their group as in compact storage 
+  vector<Location> locations = PopulationFile::load(path, NPI()); 
+  assert(locations.size() == 2); 
+  assert(locations[0].location == HOME && locations[0].size() == 5000 && locations[0].initial_seed == 20); 
+  assert(locations[1].location == WORK && locations[1].size() == 5001 && locations[1].initial_seed == 0); 
+  for (PopulationSize k = 0; k < 5000; ++k){
+    assert(locations[0].agentAge(k) == min(ageGroup((2 * k) % 90) * 10 + 5, 85)); 
+    assert(locations[0].agentStatus(k) == ((2 * k) % 500 == 0 ? EXPOSED : SUSCEPTIBLE)); 
+  }
+  assert(locations[1].agentAge(5000) == 45); 
+
+  // a run writes private copies of the pages, the file stays as it was 
+  locations[0].init(0); 
+  for (timestamp ts = 1; ts < 30 * DAY; ++ts){
+    locations[0].run(ts); 
+  }
+  assert(locations[0].report()[SUSCEPTIBLE] < 4980); 
+  vector<Location> again = PopulationFile::load(path, NPI()); 
+  PopulationSize exposed = 0; 
+  for (PopulationSize k = 0; k < 5000; ++k){
+    exposed += again[0].agentStatus(k) == EXPOSED; 
+  }
+  assert(exposed == 20); 
+
+  // the locations of a file take their place among the scenario's 
+  Scenario scenario; 
+  scenario.parse("cache off\nlocation RANDOM 100 1\npopulation " + path + "\nroute 0 2 0.1\n"); 
+  vector<Location> world = WorldImage::build(scenario); 
+  assert(world.size() == 3 && world[0].size() == 101 && world[2].size() == 5001); 
+  Simulation sim = scenario.simulation(); 
+  assert(sim.travel != nullptr && sim.travel->edges() == 1); 
+
+  // a copy of the file with a few bytes overwritten is rejected, not read past its end 
+  auto corrupt = [&path](long offset, uint64_t value, size_t bytes){
+    string copy = path + ".bad"; 
+    FILE* from = fopen(path.c_str(), "rb"); 
+    FILE* to = fopen(copy.c_str(), "wb"); 
+    int c; 
+    while ((c = fgetc(from)) != EOF){ fputc(c, to); }
+    fclose(from); 
+    fseek(to, offset, SEEK_SET); 
+    fwrite(&value, bytes, 1, to); 
+    fclose(to); 
+    bool threw = false; 
+    try {
+      PopulationFile::load(copy, NPI()); 
+    } catch (const char*){
+      threw = true; 
+    }
+    return threw; 
+  }; 
+  assert(corrupt(8, 1ULL << 59, 8));            // location count 
+  assert(corrupt(24 + 8, 1ULL << 62, 8));       // agents of location 0 
+  uint64_t first; 
+  FILE* in = fopen(path.c_str(), "rb"); 
+  fseek(in, 24 + 24, SEEK_SET); 
+  assert(fread(&first, sizeof(first), 1, in) == 1); 
+  fclose(in); 
+  assert(corrupt(first, 7, 2));                 // status of agent 0 
+  assert(corrupt(first, 15 << 6, 2));           // age group of agent 0 
+  assert(!corrupt(first, 0, 1)); 
+  // a failed rename (onto a directory) is reported 
+  mkdir("/tmp/test_population_dir", 0755); 
+  bool threw = false; 
+  try {
+    PopulationFile::convert(csv, "/tmp/test_population_dir"); 
+  } catch (const char*){
+    threw = true; 
+  }
+  assert(threw); 
+
+  out = fopen(csv.c_str(), "w"); 
+  fprintf(out, "0,HOME,30\n2,HOME,30\n"); 
+  fclose(out); 
+  threw = false; 
+  try {
+    PopulationFile::convert(csv, path); 
+  } catch (const char*){
+    threw = true; 
+  }
+  assert(threw); 
+
+  cout << "Tests for population files passed\n"; 
+}
+
+void testCalibration(){
+  bool threw = false; 
+  try {
+    Scenario bad; 
+    bad.parse("calibrate rate SEVERE 0.5 2\n"); 
+  } catch (const char*){
+    threw = true; 
+  }
+  assert(threw); 
+
+  // target data from one run with a lower transmission probability than the default 
+  string world = "simulation 0 400 1 50\ncache off\ncompact on\nlocation RANDOM 2990 10\n"; 
+  Scenario observed; 
+  observed.parse(world + "transmission RANDOM 0.15\n"); 
+  generator.seed(5); 
+  vector<Location> truth = WorldImage::build(observed); 
+  initial_transmission_prob[RANDOM] = 0.33; 
+  Simulation sim = observed.simulation(); 
+  sim.prepare(truth); 
+  Scenario scenario; 
+  scenario.parse(world + "calibrate transmission RANDOM 0.02 0.6\nabc 20 4 2 0.5\n"); 
+  assert(scenario.priors.size() == 1 && !scenario.priors[0].is_rate && scenario.abc_workers == 2); 
+  for (timestamp t = 0; t < 35 * DAY; ++t){
+    sim.step(truth, t); 
+    if (t > 0 && t % (5 * DAY) == 0){
+      scenario.parse("observe INFECTIOUS " + to_string(t / DAY) + " " + to_string(truth[0].count(INFECTIOUS)) + "\n"); 
+    }
+  }
+  assert(scenario.observations.size() == 6); 
+
+  auto calibrate = [&scenario](int workers){
+    scenario.abc_workers = workers; 
+    Calibration calibration(scenario); 
+    generator.seed(6); 
+    vector<Location> locations = WorldImage::build(scenario); 
+    calibration.run(scenario.simulation(), locations, 7); 
+    return calibration; 
+  }; 
+  Calibration calibration = calibrate(2); 
+  assert(calibration.population.size() == 20 && calibration.tolerances.size() == 4); 
+  assert(calibration.tolerances[3] <= calibration.tolerances[2] && calibration.tolerances[2] <= calibration.tolerances[1]); 
+  double total = 0; 
+  for (auto &p: calibration.population){
+    assert(p.distance <= calibration.tolerances[3] && scenario.priors[0].contains(p.theta[0])); 
+    total += p.weight; 
+  }
+  assert(abs(total - 1) < 1e-9); 
+  // runs past the tolerance stop early 
+  assert(calibration.aborted > 0 && calibration.ticks < calibration.full_ticks); 
+  // the posterior narrows around the probability the data came from 
+  assert(abs(calibration.mean(0) - 0.15) < 0.05 && sqrt(calibration.variance(0)) < 0.1); 
+  // candidates set the globals of their own process only 
+  assert(initial_transmission_prob[RANDOM] == 0.33); 
+
+  // the outcome does not depend on how many candidates run at a time 
+  Calibration serial = calibrate(1); 
+  assert(serial.tolerances == calibration.tolerances); 
+  for (size_t i = 0; i < serial.population.size(); ++i){
+    assert(serial.population[i].theta == calibration.population[i].theta); 
+  }
+
+  cout << "Tests for calibration passed\n"; 
+}
+
+void testHistory(){
+  // more events than fit a block, over several buckets; blocks of one bucket 
+  // come back in the order they were written 
+  string path = "/tmp/test_history.his"; 
+  HistoryRecorder* recorder = HistoryRecorder::create(path); 
+  vector<vector<StateEvent>> expected(3 * HISTORY_BUCKET); 
+  for (timestamp t = 0; t < 4; ++t){
+    vector<StateEvent> events; 
+    for (uint32_t a = 0; a < 3 * HISTORY_BUCKET; a += 1 + t){
+      StateEvent e = StateEvent(); 
+      e.tick = t * 100 + a % 7; 
+      e.agent = a; 
+      e.state = (a + t) % (DECEASED + 1); 
+      events.push_back(e); 
+      expected[a].push_back(e); 
+    }
+    recorder->append(1, events); 
+  }
+  delete recorder; 
+
+  unique_ptr<HistoryReader> reader(HistoryReader::open(path)); 
+  assert(reader && reader->blocks() > 3); 
+  vector<StateEvent> events; 
+  assert(reader->trajectory(1, HISTORY_BUCKET + 6, events) && events == expected[HISTORY_BUCKET + 6]); 
+  assert(reader->blocks_read < reader->blocks()); 
+  map<uint32_t, vector<StateEvent>> trajectories; 
+  vector<uint32_t> cohort{5, 2 * HISTORY_BUCKET + 11, 12}; 
+  assert(reader->cohort(1, cohort, trajectories) && trajectories.size() == 3); 
+  for (auto a: cohort){
+    assert(trajectories[a] == expected[a]); 
+  }
+  assert(reader->trajectory(0, 5, events) && events.empty()); 
+  // a block count that does not fit the file 
+  FILE* out = fopen(path.c_str(), "r+b"); 
+  uint64_t count; 
+  fseeko(out, -16, SEEK_END); 
+  assert(fread(&count, sizeof(count), 1, out) == 1); 
+  uint64_t huge = count << 40; 
+  fseeko(out, -16, SEEK_END); 
+  fwrite(&huge, sizeof(huge), 1, out); 
+  fclose(out); 
+  assert(HistoryReader::open(path) == nullptr); 
+  // an unfinished file has no index 
+  out = fopen(path.c_str(), "r+b"); 
+  fseeko(out, -1, SEEK_END); 
+  fputc('X', out); 
+  fclose(out); 
+  assert(HistoryReader::open(path) == nullptr); 
+  // a full disk is reported by close 
+  recorder = HistoryRecorder::create("/dev/full"); 
+  assert(recorder != nullptr); 
+  for (timestamp t = 0; t < 4; ++t){
+    recorder->append(0, expected[t]); 
+  }
+  assert(!recorder->close()); 
+  delete recorder; 
+
+  // a recorded run: replaying every trajectory gives the final counts, and the 
+  // history depends on the seed only, not on how many threads run a tick 
+  auto record = [&path](int threads){
+    generator.seed(21); 
+    Simulation sim(0, 40 * DAY, 1, DAY); 
+    sim.history = HistoryRecorder::create(path); 
+    vector<Location> locations; 
+    locations.push_back(Location(RANDOM, 49900, 100, MixedAge{make_pair(1, AgeInfo(50, 20))}, NPI())); 
+    locations.back().threads = threads; 
+    locations.back().concurrent_min_contacts = 1; 
+    sim.prepare(locations); 
+    for (timestamp t = sim.start_time; t < sim.end_time; ++t){
+      sim.step(locations, t); 
+    }
+    sim.history->close(); 
+    delete sim.history; 
+    vector<PopulationSize> counts; 
+    for (int s = SUSCEPTIBLE; s <= DECEASED; ++s){
+      counts.push_back(locations[0].count(static_cast<enum SEIHCRD>(s))); 
+    }
+    vector<uint32_t> everyone(50000); 
+    iota(everyone.begin(), everyone.end(), 0); 
+    map<uint32_t, vector<StateEvent>> ans; 
+    unique_ptr<HistoryReader> reader(HistoryReader::open(path)); 
+    assert(reader && reader->cohort(0, everyone, ans)); 
+    vector<PopulationSize> replayed(DECEASED + 1, 0); 
+    replayed[SUSCEPTIBLE] = 50000 - ans.size(); 
+    for (auto &agent: ans){
+      for (size_t k = 1; k < agent.second.size(); ++k){
+        assert(agent.second[k].tick >= agent.second[k - 1].tick && agent.second[k].state != agent.second[k - 1].state); 
+      }
+      ++replayed[agent.second.back().state]; 
+    }
+    assert(replayed == counts); 
+    return ans; 
+  }; 
+  map<uint32_t, vector<StateEvent>> two = record(2); 
+  assert(two.size() > 1000); 
+  assert(record(3) == two); 
+
+  cout << "Tests for history passed\n"; 
+}
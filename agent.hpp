@@ -1,4 +1,6 @@
 #include <map>
+#include <vector>
+#include <numeric>
 #include <random>
 #include <iostream>
 #include <cmath>
@@ -16,6 +18,9 @@ using namespace std;
 enum SEIHCRD {SUSCEPTIBLE, EXPOSED, INFECTIOUS, HOSPITALIZED, CRITICAL, RECOVERED, DECEASED}; 
 enum AtLocation {HOME, SCHOOL, WORK, RANDOM, HOSPITAL, CEMENTRY};  
 enum RateCategory {HOSPITALIZATION, ICU, FATALITY}; 
+// CARE_WAITED is or'ed in once the pools have had no bed for a patient 
+enum CareState {NO_CARE, WAITING_BED, IN_BED, WAITING_ICU, IN_ICU, CARE_WAITED = 8}; 
+enum TestState {NOT_TESTED, TEST_PENDING, TEST_CONFIRMED};
 
 string SEIHCRD[] = {
   "SUSCEPTIBLE", "EXPOSED", "INFECTIOUS", "HOSPITALIZED", "CRITICAL", "RECOVERED", "DECEASED"
@@ -45,9 +50,11 @@ string AtLocation[] = {
 #define INFECTIOUS_BETA 4
  
 #define HOSPITALIZATION_DELAY_MEAN 5*DAY
-#define INFECTIOUS_SELF_ISOLATE_RATIO 2/3
+#define INFECTIOUS_SELF_ISOLATE_RATIO (2.0/3)
 #define HOSPITALIZATION_CRITICAL 0.3 
 #define CRITICAL_DEATH 0.5 
+#define CRITICAL_DEATH_WITHOUT_ICU 0.9 
+#define UNTREATED_FATALITY_SCALE 2   // hospitalized without a bed 
 
 #define HOSPITAL_DAYS 8*DAY
 #define CRITICAL_DAYS 16*DAY 
@@ -60,6 +67,23 @@ string AtLocation[] = {
 
 #define PER_CAPITA_CONTACTS 24
 
+// test, trace and isolate 
+#define CONTACT_HISTORY 8           // contacts remembered per agent 
+#define TRACE_WINDOW 7*DAY          // older contacts are not traced 
+#define ISOLATION_DAYS 10*DAY       // positives and symptomatic self-isolators 
+#define QUARANTINE_DAYS 14*DAY      // traced contacts 
+#define AGE_GROUPS 9
+
+// concurrent contact phase of a single Location 
+#define CONTACT_BLOCK 4096            // contacts per work unit, fixes the random streams 
+#define PARALLEL_CONTACT_MIN 65536    // fewer contacts per tick stay serial 
+#define UPDATE_BLOCK 4096             // agents per work unit of the update phase 
+#define COW_PAGE UPDATE_BLOCK         // entries per copy-on-write page, an update work unit writes whole pages 
+
+// coupling between locations 
+#define TRAVEL_BLOCK 16384            // edges per work unit 
+#define IMPORT_ATTEMPTS 64            // tries to find a susceptible for an imported exposure 
+
 typedef long long int timestamp; 
 typedef long long int PopulationSize; 
 
@@ -67,15 +91,21 @@ typedef pair<double, double> AgeInfo; // mean, variance
 typedef vector<pair<double, AgeInfo>> MixedAge; // mixed gaussian   
 typedef map<enum SEIHCRD, PopulationSize> Summary; 
 typedef map<enum SEIHCRD, double> PercentileSummary; 
+typedef vector<vector<double>> ContactMatrix; // [age group][age group], relative contacts per pair of people 
 
 mt19937 generator(random_device{}()); 
 
+double rateByAgeGroup(enum RateCategory rate_category, int age_group); 
 bool prob2Bool(double, double precision = 0.001); 
+bool prob2Bool(mt19937& gen, double, double precision = 0.001); 
 int getAge(enum AtLocation location); 
 
 int randGaussian(double mean, double var);  
 double randGamma(double a = INFECTIOUS_ALPHA, double b = INFECTIOUS_BETA); 
+double randGamma(mt19937& gen, double a = INFECTIOUS_ALPHA, double b = INFECTIOUS_BETA); 
 int randUniform(int l, int u); 
+int randUniform(mt19937& gen, int l, int u); 
+long long binomialInverse(long long n, double p, double u); 
 int randGaussianMixture(vector<pair<double, pair<double, double>>> mixture_spec);  
 // int randGaussianMixture(vector<pair<double, AgeInfo>> mixture_spec)
 
@@ -83,6 +113,20 @@ void testPolicy();
 void testInfectiousness(); 
 void testSimulation(); 
 void testPerson(); 
+void testScenario(); 
+void testMetrics(); 
+void testConcurrentContacts(); 
+void testHospital(); 
+void testAgeMixing(); 
+void testCompact(); 
+void testInfections(); 
+void testTracing(); 
+void testVaccination(); 
+void testTravel(); 
+void testSplitting(); 
+void testPopulationFile(); 
+void testCalibration(); 
+void testHistory(); 
 
 // Estimation
 map<enum AtLocation, PopulationSize> population_by_location = {
@@ -146,16 +190,40 @@ int getHospitalizationDelay(){
 }
 
 double randGamma(double alpha, double beta) {
-  auto getGamma = [alpha, beta]() {
-    gamma_distribution<double> gamma_dist(alpha, beta); 
-    return gamma_dist(generator); 
-  }; 
-  return getGamma(); 
+  return randGamma(generator, alpha, beta); 
+}
+
+// explicit generator, for worker threads that must not share `generator` 
+double randGamma(mt19937& gen, double alpha, double beta) {
+  gamma_distribution<double> gamma_dist(alpha, beta); 
+  return gamma_dist(gen); 
 }
 
 int randUniform(int l, int u){
+  return randUniform(generator, l, u); 
+}
+
+int randUniform(mt19937& gen, int l, int u){
   uniform_int_distribution<> uniform_dist(l, u); 
-  return uniform_dist(generator); 
+  return uniform_dist(gen); 
+}
+
+// smallest k with P(X <= k) >= u for X ~ Bin(n, p), meant for a small n*p. 
+// P(0) = (1-p)^n >= 1-n*p, so for a tiny n*p most calls return 0 without 
+// a transcendental function 
+long long binomialInverse(long long n, double p, double u){
+  if (n <= 0 || p <= 0){ return 0; }
+  if (p >= 1){ return n; }
+  if (u <= 1 - n * p){ return 0; }
+  double prob = exp(n * log1p(-p)); 
+  double cdf = prob; 
+  long long k = 0; 
+  while (u > cdf && k < n){
+    prob *= (n - k) / (k + 1.0) * p / (1 - p); 
+    cdf += prob; 
+    ++k; 
+  }
+  return k; 
 }
 
 map<enum AtLocation, double> initial_transmission_prob = {
@@ -202,16 +270,31 @@ map<int, double> infection_fatality_rate = {
   {8, 0.093} 
 }; 
 
+// where an agent is after entering `to` 
+enum AtLocation locationAfter(enum SEIHCRD to, enum AtLocation current) {
+  switch (to){
+    case RECOVERED: return HOME; 
+    case HOSPITALIZED: 
+    case CRITICAL: return HOSPITAL; 
+    case DECEASED: return CEMENTRY; 
+    default: return current; 
+  }
+}
+
+// decades, 80+ in the last group. shared by the rate tables and the contact matrices 
+int ageGroup(int age) {
+  if (age > 80){
+    return AGE_GROUPS - 1; 
+  } else {
+    return age/10;
+  }
+}
+
 double rateByAge(enum RateCategory rate_category, int age) {
-  auto compute_age_group = [](int age) {
-    if (age > 80){
-      return 8; 
-    } else {
-      return age/10;
-    }
-  }; 
+  return rateByAgeGroup(rate_category, ageGroup(age)); 
+}
 
-  int age_group = compute_age_group(age); 
+double rateByAgeGroup(enum RateCategory rate_category, int age_group) {
 
   double ans = 0; 
   switch (rate_category){
@@ -226,13 +309,35 @@ double rateByAge(enum RateCategory rate_category, int age) {
 }
 
 bool prob2Bool(double probability, double precision){
+  return prob2Bool(generator, probability, precision); 
+}
+
+bool prob2Bool(mt19937& gen, double probability, double precision){
   auto double2int = [](double num){
     return static_cast<int> (num); 
   }; 
-  return randUniform(0, double2int(1/precision)) < double2int(probability/precision); 
+  return randUniform(gen, 0, double2int(1/precision)) < double2int(probability/precision); 
 }
 
 
+// efficacy of one dose: relative reduction of the chance to get infected, 
+// and of hospitalization and death once infected 
+class Vaccine {
+  public: 
+    double infection_efficacy; 
+    double severity_efficacy; 
+
+    Vaccine(){
+      infection_efficacy = 0; 
+      severity_efficacy = 0; 
+    }
+
+    Vaccine(double infection, double severity){
+      infection_efficacy = infection; 
+      severity_efficacy = severity; 
+    }
+}; 
+
 // Non-Pharmaceutical Intervention 
 class NPI {
   public: 
@@ -241,6 +346,9 @@ class NPI {
     double reduced_work_contact_rate; 
     double reduced_random_contact_rate; 
     double compliance_rate; 
+    // per age group factor on the contacts of that group (e.g. shielding the elderly), 
+    // only used with age-structured mixing 
+    vector<double> age_group_contact_scale; 
 
     NPI(){
       reduced_home_contact_rate = 0; 
@@ -248,6 +356,7 @@ class NPI {
       reduced_work_contact_rate = 0; 
       reduced_random_contact_rate = 0; 
       compliance_rate = 1; 
+      age_group_contact_scale = vector<double>(AGE_GROUPS, 1); 
     }
 
     NPI(double home, double school, double work, double random, double compliance){
@@ -256,9 +365,97 @@ class NPI {
       reduced_work_contact_rate = work; 
       reduced_random_contact_rate = random; 
       compliance_rate = compliance; 
+      age_group_contact_scale = vector<double>(AGE_GROUPS, 1); 
     } 
 }; 
 
+/*
+ * Default age mixing per location type, relative contacts between one person 
+ * of each group: assortative everywhere, households add a parent/child and a 
+ * grandparent coupling, schools are children plus staff, work is 20-69. 
+*/
+ContactMatrix defaultContactMatrix(enum AtLocation loc){
+  ContactMatrix ans(AGE_GROUPS, vector<double>(AGE_GROUPS, 0)); 
+  for (int i = 0; i < AGE_GROUPS; ++i){
+    for (int j = 0; j < AGE_GROUPS; ++j){
+      int gap = abs(i - j); 
+      double assortative = exp(-gap / 1.5); 
+      switch (loc){
+        case HOME: 
+          ans[i][j] = assortative + (gap == 3 ? 0.8 : 0) + (gap == 6 ? 0.3 : 0); break; 
+        case SCHOOL: 
+          ans[i][j] = (i < 2 && j < 2) ? 1 + (gap == 0) : ((i < 2) != (j < 2) && max(i, j) < 7 ? 0.1 : 0.01); break; 
+        case WORK: 
+          ans[i][j] = (i >= 2 && i <= 6 && j >= 2 && j <= 6) ? 0.5 + 0.5 * assortative : 0.01; break; 
+        default: 
+          ans[i][j] = assortative; break; 
+      }
+    }
+  }
+  return ans; 
+}
+
+map<enum AtLocation, ContactMatrix> contact_matrix_by_location = {
+  {HOME, defaultContactMatrix(HOME)}, 
+  {SCHOOL, defaultContactMatrix(SCHOOL)}, 
+  {WORK, defaultContactMatrix(WORK)}, 
+  {RANDOM, defaultContactMatrix(RANDOM)} 
+}; 
+
+/*
+ * Walker/Vose alias table: O(n) to build, O(1) per draw from a discrete 
+ * distribution given by non-negative weights. 
+*/
+class AliasTable {
+  private: 
+    vector<double> prob; 
+    vector<int> alias; 
+
+  public: 
+    AliasTable(){}
+
+    AliasTable(const vector<double>& weights){
+      int n = weights.size(); 
+      double sum = accumulate(weights.begin(), weights.end(), 0.0); 
+      if (n == 0 || sum <= 0){
+        throw "Invalid alias table weights!"; 
+      }
+      prob.assign(n, 0); 
+      alias.assign(n, 0); 
+      vector<double> scaled(n); 
+      vector<int> small, large; 
+      for (int i = 0; i < n; ++i){
+        scaled[i] = weights[i] * n / sum; 
+        (scaled[i] < 1 ? small : large).push_back(i); 
+      }
+      while (!small.empty() && !large.empty()){
+        int s = small.back(); small.pop_back(); 
+        int l = large.back(); 
+        prob[s] = scaled[s]; 
+        alias[s] = l; 
+        scaled[l] -= 1 - scaled[s]; 
+        if (scaled[l] < 1){
+          large.pop_back(); 
+          small.push_back(l); 
+        }
+      }
+      // leftovers are 1 up to rounding 
+      for (auto i: large){ prob[i] = 1; }
+      for (auto i: small){ prob[i] = 1; }
+    }
+
+    int size(){
+      return prob.size(); 
+    }
+
+    int sample(mt19937& gen){
+      uniform_int_distribution<int> column(0, prob.size() - 1); 
+      uniform_real_distribution<double> coin(0, 1); 
+      int i = column(gen); 
+      return coin(gen) < prob[i] ? i : alias[i]; 
+    }
+}; 
+
 class TransmissionProb {
   private: 
     double getInitProb (enum AtLocation loc) {
@@ -308,7 +505,8 @@ class TransmissionProb {
 
       map<enum AtLocation, double> ans{}; 
       vector<enum AtLocation> locations {HOME, SCHOOL, WORK, RANDOM}; 
-      auto red_it = applyReduction().begin(); 
+      vector<double> reduction = applyReduction(); 
+      auto red_it = reduction.begin(); 
 
       for (auto loc: locations){
         ans.insert(pair<enum AtLocation, double>(loc, *red_it)); 
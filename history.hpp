@@ -0,0 +1,363 @@
+#ifndef HISTORY_HPP
+#define HISTORY_HPP
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * Per-agent state history: every status change of every agent, recorded for
+ * analysis after the run. Locations collect the changes of a tick (see
+ * Location::newTransitions), the Simulation hands them to a HistoryRecorder
+ * once per tick, so recording costs per transition and nothing for agents
+ * that stay put.
+ *
+ * Events are grouped by location and range of HISTORY_BUCKET agents. Each group
+ * fills a block of up to HISTORY_BLOCK_EVENTS events that is stored in three
+ * columns: zigzag varint deltas of the tick and of the agent against the
+ * previous event of the block, then one byte of state per event. Full blocks
+ * are written by a background thread; an index of all blocks closes the file,
+ * so a reader decodes only the blocks of the agents it asks for.
+*/
+
+#define HISTORY_MAGIC "EPIHIS01"
+#define HISTORY_BUCKET 16384          // agents per group of blocks
+#define HISTORY_BLOCK_EVENTS 16384    // events per full block
+#define HISTORY_QUEUE_BYTES (64 << 20)  // blocks waiting for the writer before append() waits
+
+class StateEvent {
+  public:
+    int64_t tick;     // tick the agent entered `state` at
+    uint32_t agent;   // index within its location
+    uint8_t state;    // an enum SEIHCRD
+
+    bool operator==(const StateEvent& other) const {
+      return tick == other.tick && agent == other.agent && state == other.state; 
+    }
+}; 
+
+// one entry of the index at the end of the file
+class HistoryBlock {
+  public:
+    uint32_t location; 
+    uint32_t first_agent;   // of the bucket, agent deltas start from it
+    uint32_t events; 
+    uint32_t tick_bytes; 
+    uint32_t agent_bytes; 
+    uint32_t state_bytes; 
+    int64_t first_tick;     // tick deltas start from it
+    int64_t last_tick; 
+    uint64_t offset; 
+}; 
+
+class HistoryColumns {
+  public:
+    static void putVarint(std::vector<uint8_t>& out, uint64_t v){
+      while (v >= 0x80){
+        out.push_back(static_cast<uint8_t>(v) | 0x80); 
+        v >>= 7; 
+      }
+      out.push_back(static_cast<uint8_t>(v)); 
+    }
+
+    static void putSigned(std::vector<uint8_t>& out, int64_t v){
+      putVarint(out, (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63)); 
+    }
+
+    static bool getSigned(const uint8_t* data, size_t size, size_t& pos, int64_t& v){
+      uint64_t u = 0; 
+      for (int shift = 0; shift < 64; shift += 7){
+        if (pos >= size){ return false; }
+        uint8_t byte = data[pos++]; 
+        u |= static_cast<uint64_t>(byte & 0x7f) << shift; 
+        if (!(byte & 0x80)){
+          v = static_cast<int64_t>(u >> 1) ^ -static_cast<int64_t>(u & 1); 
+          return true; 
+        }
+      }
+      return false; 
+    }
+}; 
+
+class HistoryRecorder {
+  private:
+    // the block being filled for one bucket of one location
+    class Pending {
+      public:
+        HistoryBlock block = HistoryBlock(); 
+        std::vector<uint8_t> ticks; 
+        std::vector<uint8_t> agents; 
+        std::vector<uint8_t> states; 
+        int64_t prev_tick = 0; 
+        uint32_t prev_agent = 0; 
+    }; 
+
+    FILE* out; 
+    uint64_t written = 8;   // file offset of the next block, after the magic
+    std::vector<std::vector<Pending>> pending;   // by location, then bucket
+    std::vector<HistoryBlock> index; 
+    bool closed = false; 
+    bool failed = false;   // a write came up short, under lock while the writer runs
+
+    // handed to the writer thread
+    std::mutex lock; 
+    std::condition_variable changed; 
+    std::deque<std::vector<uint8_t>> queue; 
+    size_t queued_bytes = 0; 
+    bool stopping = false; 
+    std::thread writer; 
+
+    HistoryRecorder(FILE* file){
+      out = file; 
+      writer = std::thread([this](){ drain(); }); 
+    }
+
+    void drain(){
+      std::unique_lock<std::mutex> guard(lock); 
+      while (true){
+        changed.wait(guard, [this](){ return stopping || !queue.empty(); }); 
+        if (queue.empty()){ return; }
+        std::vector<uint8_t> bytes = std::move(queue.front()); 
+        queue.pop_front(); 
+        guard.unlock(); 
+        bool ok = fwrite(bytes.data(), 1, bytes.size(), out) == bytes.size(); 
+        guard.lock(); 
+        failed = failed || !ok; 
+        queued_bytes -= bytes.size(); 
+        changed.notify_all(); 
+      }
+    }
+
+    void seal(Pending& p){
+      if (p.block.events == 0){ return; }
+      p.block.tick_bytes = p.ticks.size(); 
+      p.block.agent_bytes = p.agents.size(); 
+      p.block.state_bytes = p.states.size(); 
+      p.block.offset = written; 
+      std::vector<uint8_t> bytes; 
+      bytes.reserve(p.ticks.size() + p.agents.size() + p.states.size()); 
+      bytes.insert(bytes.end(), p.ticks.begin(), p.ticks.end()); 
+      bytes.insert(bytes.end(), p.agents.begin(), p.agents.end()); 
+      bytes.insert(bytes.end(), p.states.begin(), p.states.end()); 
+      written += bytes.size(); 
+      index.push_back(p.block); 
+      p.ticks.clear(); 
+      p.agents.clear(); 
+      p.states.clear(); 
+      p.block.events = 0; 
+
+      std::unique_lock<std::mutex> guard(lock); 
+      changed.wait(guard, [this](){ return queued_bytes < HISTORY_QUEUE_BYTES; }); 
+      queued_bytes += bytes.size(); 
+      queue.push_back(std::move(bytes)); 
+      changed.notify_all(); 
+    }
+
+  public:
+    // returns nullptr when the file cannot be created
+    static HistoryRecorder* create(const std::string& path){
+      FILE* file = fopen(path.c_str(), "wb"); 
+      if (file == nullptr){ return nullptr; }
+      if (fwrite(HISTORY_MAGIC, 1, 8, file) != 8){
+        fclose(file); 
+        return nullptr; 
+      }
+      return new HistoryRecorder(file); 
+    }
+
+    ~HistoryRecorder(){
+      close(); 
+    }
+
+    HistoryRecorder(const HistoryRecorder&) = delete; 
+    HistoryRecorder& operator=(const HistoryRecorder&) = delete; 
+
+    // the events of one location, in tick order per agent
+    void append(uint32_t location, const std::vector<StateEvent>& events){
+      if (pending.size() <= location){
+        pending.resize(location + 1); 
+      }
+      std::vector<Pending>& buckets = pending[location]; 
+      for (auto &e: events){
+        uint32_t bucket = e.agent / HISTORY_BUCKET; 
+        if (buckets.size() <= bucket){
+          buckets.resize(bucket + 1); 
+        }
+        Pending& p = buckets[bucket]; 
+        if (p.block.events == 0){
+          p.block.location = location; 
+          p.block.first_agent = bucket * HISTORY_BUCKET; 
+          p.block.first_tick = p.block.last_tick = p.prev_tick = e.tick; 
+          p.prev_agent = p.block.first_agent; 
+        }
+        HistoryColumns::putSigned(p.ticks, e.tick - p.prev_tick); 
+        HistoryColumns::putSigned(p.agents, static_cast<int64_t>(e.agent) - p.prev_agent); 
+        p.states.push_back(e.state); 
+        p.prev_tick = e.tick; 
+        p.prev_agent = e.agent; 
+        p.block.last_tick = std::max(p.block.last_tick, e.tick); 
+        if (++p.block.events == HISTORY_BLOCK_EVENTS){
+          seal(p); 
+        }
+      }
+    }
+
+    // writes the partial blocks and the index; the file is complete afterwards 
+    // unless it returns false, when some write failed (a full disk)
+    bool close(){
+      if (closed){ return !failed; }
+      closed = true; 
+      for (auto &buckets: pending){
+        for (auto &p: buckets){
+          seal(p); 
+        }
+      }
+      {
+        std::lock_guard<std::mutex> guard(lock); 
+        stopping = true; 
+      }
+      changed.notify_all(); 
+      writer.join(); 
+      uint64_t blocks = index.size(); 
+      bool ok = fwrite(index.data(), sizeof(HistoryBlock), index.size(), out) == index.size() &&
+                fwrite(&written, sizeof(written), 1, out) == 1 &&
+                fwrite(&blocks, sizeof(blocks), 1, out) == 1 &&
+                fwrite(HISTORY_MAGIC, 1, 8, out) == 8; 
+      ok = fclose(out) == 0 && ok; 
+      failed = failed || !ok; 
+      return !failed; 
+    }
+
+    uint64_t bytes(){
+      return written; 
+    }
+}; 
+
+/*
+ * Random access to a history file: the index is read once, a query decodes
+ * only the blocks whose bucket holds one of its agents.
+*/
+class HistoryReader {
+  private:
+    FILE* in; 
+    std::vector<HistoryBlock> index; 
+
+    HistoryReader(FILE* file, std::vector<HistoryBlock>& blocks){
+      in = file; 
+      index.swap(blocks); 
+    }
+
+    bool decode(const HistoryBlock& block, std::vector<StateEvent>& events){
+      std::vector<uint8_t> data(static_cast<size_t>(block.tick_bytes) + block.agent_bytes + block.state_bytes); 
+      if (fseeko(in, block.offset, SEEK_SET) != 0 || fread(data.data(), 1, data.size(), in) != data.size()){
+        return false; 
+      }
+      ++blocks_read; 
+      const uint8_t* ticks = data.data(); 
+      const uint8_t* agents = ticks + block.tick_bytes; 
+      const uint8_t* states = agents + block.agent_bytes; 
+      if (block.state_bytes != block.events){ return false; }
+      size_t tick_pos = 0, agent_pos = 0; 
+      StateEvent e; 
+      e.tick = block.first_tick; 
+      e.agent = block.first_agent; 
+      for (uint32_t k = 0; k < block.events; ++k){
+        int64_t dtick, dagent; 
+        if (!(HistoryColumns::getSigned(ticks, block.tick_bytes, tick_pos, dtick) &&
+              HistoryColumns::getSigned(agents, block.agent_bytes, agent_pos, dagent))){
+          return false; 
+        }
+        e.tick += dtick; 
+        e.agent += dagent; 
+        e.state = states[k]; 
+        events.push_back(e); 
+      }
+      return true; 
+    }
+
+  public:
+    size_t blocks_read = 0; 
+
+    // returns nullptr on a missing, unfinished or malformed file
+    static HistoryReader* open(const std::string& path){
+      FILE* file = fopen(path.c_str(), "rb"); 
+      if (file == nullptr){ return nullptr; }
+      char magic[8]; 
+      uint64_t footer[2]; 
+      std::vector<HistoryBlock> blocks; 
+      off_t size = fseeko(file, 0, SEEK_END) == 0 ? ftello(file) : -1; 
+      bool ok = size >= 32 && fseeko(file, 0, SEEK_SET) == 0 &&
+                fread(magic, 1, 8, file) == 8 && memcmp(magic, HISTORY_MAGIC, 8) == 0 &&
+                fseeko(file, -24, SEEK_END) == 0 && fread(footer, sizeof(uint64_t), 2, file) == 2 &&
+                fread(magic, 1, 8, file) == 8 && memcmp(magic, HISTORY_MAGIC, 8) == 0; 
+      // the index must fill the file between the last block and the footer 
+      uint64_t table = static_cast<uint64_t>(size) - 24; 
+      ok = ok && footer[0] >= 8 && footer[0] <= table && 
+           footer[1] == (table - footer[0]) / sizeof(HistoryBlock) && 
+           (table - footer[0]) % sizeof(HistoryBlock) == 0; 
+      if (ok){
+        blocks.resize(footer[1]); 
+        ok = fseeko(file, footer[0], SEEK_SET) == 0 &&
+             fread(blocks.data(), sizeof(HistoryBlock), blocks.size(), file) == blocks.size(); 
+      }
+      if (!ok){
+        fclose(file); 
+        return nullptr; 
+      }
+      return new HistoryReader(file, blocks); 
+    }
+
+    ~HistoryReader(){
+      fclose(in); 
+    }
+
+    size_t blocks(){
+      return index.size(); 
+    }
+
+    // the trajectories of some agents of one location, each in tick order; 
+    // agents that never changed state are missing. false on a malformed block
+    bool cohort(uint32_t location, const std::vector<uint32_t>& agents,
+                std::map<uint32_t, std::vector<StateEvent>>& trajectories){
+      trajectories.clear(); 
+      std::map<uint32_t, std::vector<uint32_t>> by_bucket; 
+      for (auto a: agents){
+        by_bucket[a / HISTORY_BUCKET].push_back(a); 
+      }
+      for (auto &bucket: by_bucket){
+        std::sort(bucket.second.begin(), bucket.second.end()); 
+      }
+      std::vector<StateEvent> events; 
+      for (auto &block: index){
+        if (block.location != location || !by_bucket.count(block.first_agent / HISTORY_BUCKET)){
+          continue; 
+        }
+        events.clear(); 
+        if (!decode(block, events)){ return false; }
+        const std::vector<uint32_t>& wanted = by_bucket[block.first_agent / HISTORY_BUCKET]; 
+        for (auto &e: events){
+          if (std::binary_search(wanted.begin(), wanted.end(), e.agent)){
+            trajectories[e.agent].push_back(e); 
+          }
+        }
+      }
+      return true; 
+    }
+
+    bool trajectory(uint32_t location, uint32_t agent, std::vector<StateEvent>& events){
+      std::map<uint32_t, std::vector<StateEvent>> trajectories; 
+      if (!cohort(location, std::vector<uint32_t>{agent}, trajectories)){ return false; }
+      events = trajectories[agent]; 
+      return true; 
+    }
+}; 
+
+#endif
@@ -0,0 +1,290 @@
+#ifndef INFECTIONS_HPP
+#define INFECTIONS_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/*
+ * Who infected whom, where and when. Locations collect the infections of a
+ * tick in their own buffers (one per contact block when the tick runs on
+ * several threads, see Location::concurrentContacts), the Simulation drains
+ * them once per tick into an append-only InfectionLog file and an online
+ * ReproductionEstimator. Nothing in here is touched from inside a tick.
+*/
+
+#define INFECTION_LOG_MAGIC "EPIINF01"
+#define INFECTION_LOG_COMPRESSED_MAGIC "EPIINFZ1"
+#define INFECTION_LOG_BUFFER (1 << 20)
+// infector of the agents that were already exposed when the simulation started
+#define NO_INFECTOR UINT32_MAX
+
+class InfectionEvent {
+  public:
+    int64_t tick; 
+    // tick the infector was infected at, -1 if unknown (e.g. the seeds)
+    int64_t infector_tick; 
+    uint32_t location;   // index of the location in the Simulation
+    uint32_t infector;   // agent indices within that location
+    uint32_t infectee; 
+
+    bool operator==(const InfectionEvent& other) const {
+      return tick == other.tick && infector_tick == other.infector_tick && location == other.location &&
+             infector == other.infector && infectee == other.infectee; 
+    }
+}; 
+
+/*
+ * Online estimates over the transmission tree. Events are added in O(1); each
+ * report costs O(window x longest interval):
+ *   instantaneous Rt (Cori et al.): infections in a window over the infection
+ *     pressure sum_s I(t-s) w(s), with w the generation interval
+ *     distribution observed so far
+ *   case Rt: mean number of infections caused so far by the agents infected
+ *     in a window; final once that cohort is no longer infectious
+ *   generation interval: ticks between the infection of infector and infectee
+*/
+class ReproductionEstimator {
+  private:
+    std::vector<int64_t> incidence;  // by tick, seeds included
+    std::vector<int64_t> secondary;  // by tick of the infector's infection
+    std::vector<int64_t> generation; // histogram, by interval in ticks
+    int64_t generations = 0; 
+    double generation_sum = 0; 
+
+    static void bump(std::vector<int64_t>& counts, int64_t idx){
+      if ((int64_t)counts.size() <= idx){
+        counts.resize(idx + 1, 0); 
+      }
+      ++counts[idx]; 
+    }
+
+    static int64_t at(const std::vector<int64_t>& counts, int64_t idx){
+      return (idx >= 0 && idx < (int64_t)counts.size()) ? counts[idx] : 0; 
+    }
+
+  public:
+    void add(const InfectionEvent& e){
+      bump(incidence, e.tick); 
+      if (e.infector_tick < 0){ return; }
+      bump(secondary, e.infector_tick); 
+      bump(generation, e.tick - e.infector_tick); 
+      ++generations; 
+      generation_sum += e.tick - e.infector_tick; 
+    }
+
+    int64_t infections(int64_t from, int64_t to) const {
+      int64_t ans = 0; 
+      for (int64_t t = from; t < to; ++t){
+        ans += at(incidence, t); 
+      }
+      return ans; 
+    }
+
+    double meanGenerationInterval() const {
+      return generations > 0 ? generation_sum / generations : 0; 
+    }
+
+    // w(s) for s = 0 .. longest interval seen, sums to 1 once any is seen
+    std::vector<double> generationDistribution() const {
+      std::vector<double> ans(generation.size(), 0); 
+      for (size_t s = 0; s < generation.size(); ++s){
+        ans[s] = 1.0 * generation[s] / generations; 
+      }
+      return ans; 
+    }
+
+    // infections in ticks [from, to), 0 when there is no infection pressure yet
+    double instantaneousRt(int64_t from, int64_t to) const {
+      double pressure = 0; 
+      for (int64_t t = from; t < to; ++t){
+        for (size_t s = 1; s < generation.size(); ++s){
+          pressure += at(incidence, t - s) * (1.0 * generation[s] / generations); 
+        }
+      }
+      return pressure > 0 ? infections(from, to) / pressure : 0; 
+    }
+
+    double caseRt(int64_t from, int64_t to) const {
+      int64_t offspring = 0; 
+      for (int64_t t = from; t < to; ++t){
+        offspring += at(secondary, t); 
+      }
+      int64_t cohort = infections(from, to); 
+      return cohort > 0 ? 1.0 * offspring / cohort : 0; 
+    }
+}; 
+
+/*
+ * Append-only event file. Events are buffered in memory and written
+ * INFECTION_LOG_BUFFER bytes at a time. The estimates of every report
+ * interval go to a text file next to it (<path>.rt).
+ *   raw:        magic, then 28 bytes per event (tick, infector_tick,
+ *               location, infector, infectee)
+ *   compressed: magic, then per event the zigzag varint deltas of tick and
+ *               location against the previous event, infectee, infector + 1
+ *               and tick - infector_tick + 1 (0 for none); about 9 bytes
+ *               per event (the agent indices take most of them) against 28
+*/
+class InfectionLog {
+  private:
+    FILE* out; 
+    FILE* estimates; 
+    bool compressed; 
+    std::vector<uint8_t> buffer; 
+    InfectionEvent last; 
+
+    void putVarint(uint64_t v){
+      while (v >= 0x80){
+        buffer.push_back(static_cast<uint8_t>(v) | 0x80); 
+        v >>= 7; 
+      }
+      buffer.push_back(static_cast<uint8_t>(v)); 
+    }
+
+    void putSigned(int64_t v){
+      putVarint((static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63)); 
+    }
+
+    template <class T>
+    void putRaw(T v){
+      const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&v); 
+      buffer.insert(buffer.end(), bytes, bytes + sizeof(T)); 
+    }
+
+    static bool getVarint(const std::vector<uint8_t>& data, size_t& pos, uint64_t& v){
+      v = 0; 
+      for (int shift = 0; pos < data.size() && shift < 64; shift += 7){
+        uint8_t byte = data[pos++]; 
+        v |= static_cast<uint64_t>(byte & 0x7f) << shift; 
+        if (!(byte & 0x80)){ return true; }
+      }
+      return false; 
+    }
+
+    static bool getSigned(const std::vector<uint8_t>& data, size_t& pos, int64_t& v){
+      uint64_t u; 
+      if (!getVarint(data, pos, u)){ return false; }
+      v = static_cast<int64_t>(u >> 1) ^ -static_cast<int64_t>(u & 1); 
+      return true; 
+    }
+
+    InfectionLog(FILE* file, FILE* rt, bool compress){
+      out = file; 
+      estimates = rt; 
+      compressed = compress; 
+      last = InfectionEvent(); 
+      buffer.reserve(INFECTION_LOG_BUFFER); 
+    }
+
+  public:
+    ReproductionEstimator estimator; 
+
+    // returns nullptr when the files cannot be created
+    static InfectionLog* create(const std::string& path, bool compress){
+      FILE* file = fopen(path.c_str(), "wb"); 
+      if (file == nullptr){ return nullptr; }
+      FILE* rt = fopen((path + ".rt").c_str(), "w"); 
+      if (rt == nullptr){
+        fclose(file); 
+        return nullptr; 
+      }
+      fwrite(compress ? INFECTION_LOG_COMPRESSED_MAGIC : INFECTION_LOG_MAGIC, 1, 8, file); 
+      fprintf(rt, "# day infections Rt case_Rt mean_generation_interval\n"); 
+      return new InfectionLog(file, rt, compress); 
+    }
+
+    ~InfectionLog(){
+      flush(); 
+      fclose(out); 
+      fclose(estimates); 
+    }
+
+    void flush(){
+      fwrite(buffer.data(), 1, buffer.size(), out); 
+      buffer.clear(); 
+      fflush(out); 
+      fflush(estimates); 
+    }
+
+    // one line of estimates for the infections in ticks [from, to) 
+    void report(long long day, int64_t from, int64_t to){
+      fprintf(estimates, "%lld %lld %.4f %.4f %.4f\n", day, (long long) estimator.infections(from, to), 
+              estimator.instantaneousRt(from, to), estimator.caseRt(from, to), estimator.meanGenerationInterval()); 
+    }
+
+    // the events of one location for one tick
+    void append(uint32_t location, std::vector<InfectionEvent>& events){
+      for (auto &e: events){
+        e.location = location; 
+        estimator.add(e); 
+        if (compressed){
+          putSigned(e.tick - last.tick); 
+          putSigned(static_cast<int64_t>(e.location) - last.location); 
+          putVarint(e.infectee); 
+          putVarint(e.infector == NO_INFECTOR ? 0 : e.infector + 1ULL); 
+          putVarint(e.infector_tick < 0 ? 0 : e.tick - e.infector_tick + 1); 
+          last = e; 
+        } else {
+          putRaw(e.tick); 
+          putRaw(e.infector_tick); 
+          putRaw(e.location); 
+          putRaw(e.infector); 
+          putRaw(e.infectee); 
+        }
+      }
+      if (buffer.size() >= INFECTION_LOG_BUFFER){
+        fwrite(buffer.data(), 1, buffer.size(), out); 
+        buffer.clear(); 
+      }
+    }
+
+    // reads back either format, false on a missing or malformed file
+    static bool read(const std::string& path, std::vector<InfectionEvent>& events){
+      events.clear(); 
+      FILE* in = fopen(path.c_str(), "rb"); 
+      if (in == nullptr){ return false; }
+      std::vector<uint8_t> data; 
+      uint8_t chunk[65536]; 
+      size_t n; 
+      while ((n = fread(chunk, 1, sizeof(chunk), in)) > 0){
+        data.insert(data.end(), chunk, chunk + n); 
+      }
+      fclose(in); 
+      if (data.size() < 8){ return false; }
+      bool compress = memcmp(data.data(), INFECTION_LOG_COMPRESSED_MAGIC, 8) == 0; 
+      if (!compress && memcmp(data.data(), INFECTION_LOG_MAGIC, 8) != 0){ return false; }
+
+      size_t pos = 8; 
+      InfectionEvent e = InfectionEvent(); 
+      while (pos < data.size()){
+        if (compress){
+          int64_t dtick, dlocation; 
+          uint64_t infectee, infector, interval; 
+          if (!(getSigned(data, pos, dtick) && getSigned(data, pos, dlocation) && getVarint(data, pos, infectee) &&
+                getVarint(data, pos, infector) && getVarint(data, pos, interval))){
+            return false; 
+          }
+          e.tick += dtick; 
+          e.location += dlocation; 
+          e.infectee = infectee; 
+          e.infector = infector == 0 ? NO_INFECTOR : infector - 1; 
+          e.infector_tick = interval == 0 ? -1 : e.tick - (int64_t)(interval - 1); 
+        } else {
+          if (data.size() - pos < 28){ return false; }
+          memcpy(&e.tick, &data[pos], 8); 
+          memcpy(&e.infector_tick, &data[pos + 8], 8); 
+          memcpy(&e.location, &data[pos + 16], 4); 
+          memcpy(&e.infector, &data[pos + 20], 4); 
+          memcpy(&e.infectee, &data[pos + 24], 4); 
+          pos += 28; 
+        }
+        events.push_back(e); 
+      }
+      return true; 
+    }
+}; 
+
+#endif
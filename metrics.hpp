@@ -0,0 +1,155 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/*
+ * Live metrics published by a running Simulation into POSIX shared memory.
+ * The simulation is the only writer; any number of viewers (see viewer.cpp)
+ * may attach read-only at any time. Every slot of the ring is guarded by a
+ * seqlock, so the writer never waits on readers and readers simply retry
+ * when they race with a write.
+*/
+
+#define METRICS_MAGIC 0x45504d4554524943ULL  // "EPMETRIC"
+#define METRICS_RING_SIZE 256
+#define METRICS_STATES 7   // SEIHCRD
+#define METRICS_PHASES 3
+
+enum MetricsPhase {PHASE_CONTACT, PHASE_UPDATE, PHASE_REPORT}; 
+
+class MetricsSample {
+  public:
+    long long tick; 
+    long long end_tick; 
+    long long counts[METRICS_STATES]; 
+    double phase_seconds[METRICS_PHASES];  // spent in the last tick
+    double agents_per_second;              // agent-ticks over the last tick
+    double elapsed_seconds; 
+    // hospital occupancy, zero with unlimited capacity
+    long long beds_in_use; 
+    long long icu_in_use; 
+    long long waiting_for_bed; 
+    long long waiting_for_icu; 
+    // testing totals so far, zero without testing
+    long long tests_done; 
+    long long positive_tests; 
+    long long waiting_for_test; 
+    long long doses_given; 
+}; 
+
+class MetricsSlot {
+  public:
+    std::atomic<uint32_t> sequence;  // odd while being written
+    MetricsSample sample; 
+}; 
+
+class MetricsSegment {
+  public:
+    uint64_t magic; 
+    std::atomic<uint64_t> head;  // number of samples ever published
+    MetricsSlot ring[METRICS_RING_SIZE]; 
+}; 
+
+class LiveMetrics {
+  private:
+    std::string name; 
+    MetricsSegment* segment; 
+    bool owner; 
+
+    LiveMetrics(const std::string& shm_name, MetricsSegment* seg, bool is_owner){
+      name = shm_name; 
+      segment = seg; 
+      owner = is_owner; 
+    }
+
+  public:
+    // writer side: creates (or truncates) the segment, returns nullptr on failure
+    static LiveMetrics* create(const std::string& shm_name){
+      int fd = shm_open(shm_name.c_str(), O_CREAT | O_RDWR, 0644); 
+      if (fd < 0){ return nullptr; }
+      if (ftruncate(fd, sizeof(MetricsSegment)) != 0){
+        close(fd); 
+        return nullptr; 
+      }
+      void* addr = mmap(nullptr, sizeof(MetricsSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0); 
+      close(fd); 
+      if (addr == MAP_FAILED){ return nullptr; }
+      MetricsSegment* seg = static_cast<MetricsSegment*>(addr); 
+      memset(addr, 0, sizeof(MetricsSegment)); 
+      seg->magic = METRICS_MAGIC; 
+      return new LiveMetrics(shm_name, seg, true); 
+    }
+
+    // reader side: attaches to an existing segment, returns nullptr if absent
+    static LiveMetrics* attach(const std::string& shm_name){
+      int fd = shm_open(shm_name.c_str(), O_RDONLY, 0); 
+      if (fd < 0){ return nullptr; }
+      void* addr = mmap(nullptr, sizeof(MetricsSegment), PROT_READ, MAP_SHARED, fd, 0); 
+      close(fd); 
+      if (addr == MAP_FAILED){ return nullptr; }
+      MetricsSegment* seg = static_cast<MetricsSegment*>(addr); 
+      if (seg->magic != METRICS_MAGIC){
+        munmap(addr, sizeof(MetricsSegment)); 
+        return nullptr; 
+      }
+      return new LiveMetrics(shm_name, seg, false); 
+    }
+
+    ~LiveMetrics(){
+      munmap(segment, sizeof(MetricsSegment)); 
+    }
+
+    // the segment outlives the writer so a viewer can read the final state;
+    // call unlink() to remove it explicitly
+    void unlink(){
+      if (owner){ shm_unlink(name.c_str()); }
+    }
+
+    void publish(const MetricsSample& sample){
+      uint64_t head = segment->head.load(std::memory_order_relaxed); 
+      MetricsSlot& slot = segment->ring[head % METRICS_RING_SIZE]; 
+      uint32_t seq = slot.sequence.load(std::memory_order_relaxed); 
+      slot.sequence.store(seq + 1, std::memory_order_relaxed); 
+      std::atomic_thread_fence(std::memory_order_release); 
+      slot.sample = sample; 
+      slot.sequence.store(seq + 2, std::memory_order_release); 
+      segment->head.store(head + 1, std::memory_order_release); 
+    }
+
+    uint64_t published(){
+      return segment->head.load(std::memory_order_acquire); 
+    }
+
+    // copies the index-th sample ever published;
+    // false if it is not published yet or has already been overwritten
+    bool read(uint64_t index, MetricsSample& out){
+      while (true){
+        uint64_t head = published(); 
+        if (index >= head || head - index > METRICS_RING_SIZE){ return false; }
+        MetricsSlot& slot = segment->ring[index % METRICS_RING_SIZE]; 
+        uint32_t before = slot.sequence.load(std::memory_order_acquire); 
+        if (before & 1){ continue; }
+        out = slot.sample; 
+        std::atomic_thread_fence(std::memory_order_acquire); 
+        uint32_t after = slot.sequence.load(std::memory_order_relaxed); 
+        if (before == after && published() - index <= METRICS_RING_SIZE){ return true; }
+      }
+    }
+
+    bool latest(MetricsSample& out){
+      while (true){
+        uint64_t head = published(); 
+        if (head == 0){ return false; }
+        if (read(head - 1, out)){ return true; }
+      }
+    }
+}; 
+
+#endif
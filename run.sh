@@ -1,5 +1,5 @@
 #!/bin/bash
 
 rm agent
-g++ -std=c++11 -g -Wall -fPIC agent.cpp -o agent && ./agent > log.dat
+g++ -std=c++11 -g -Wall -fPIC agent.cpp -o agent -pthread -lrt && ./agent scenarios/default.scenario > log.dat
 gnuplot -persist script.gp
@@ -0,0 +1,67 @@
+#include <chrono>
+#include <thread>
+
+#include "agent.hpp"
+#include "metrics.hpp"
+
+/*
+ * Prints the live metrics of a running simulation (scenario directive `metrics <name>`). 
+ *   ./viewer /epidemic          print the latest sample once 
+ *   ./viewer /epidemic follow   print every new sample until interrupted 
+*/
+
+using namespace std; 
+
+void printSample(const MetricsSample& sample){
+  cout << "tick " << sample.tick << "/" << sample.end_tick 
+       << " (day " << sample.tick/DAY << ", " << sample.elapsed_seconds << "s)" << endl; 
+  for (int i = SUSCEPTIBLE; i <= DECEASED; ++i){
+    cout << "  " << SEIHCRD[i] << " " << sample.counts[i] << endl; 
+  }
+  cout << "  contact " << sample.phase_seconds[PHASE_CONTACT] << "s" 
+       << " update " << sample.phase_seconds[PHASE_UPDATE] << "s" 
+       << " report " << sample.phase_seconds[PHASE_REPORT] << "s" 
+       << " throughput " << sample.agents_per_second << " agents/s" << endl; 
+  cout << "  beds " << sample.beds_in_use << " (+" << sample.waiting_for_bed << " waiting)" 
+       << " icu " << sample.icu_in_use << " (+" << sample.waiting_for_icu << " waiting)" << endl; 
+  cout << "  tests " << sample.tests_done << " (" << sample.positive_tests << " positive, +" 
+       << sample.waiting_for_test << " waiting)" << " vaccinated " << sample.doses_given << endl; 
+}
+
+int main(int argc, char** argv){
+  if (argc < 2){
+    cerr << "usage: " << argv[0] << " <shm name> [follow]" << endl; 
+    return 1; 
+  }
+  LiveMetrics* metrics = LiveMetrics::attach(argv[1]); 
+  if (metrics == nullptr){
+    cerr << "No metrics segment " << argv[1] << endl; 
+    return 1; 
+  }
+
+  MetricsSample sample; 
+  if (argc < 3){
+    if (metrics->latest(sample)){
+      printSample(sample); 
+    }
+    return 0; 
+  }
+
+  uint64_t next = metrics->published(); 
+  while (true){
+    uint64_t head = metrics->published(); 
+    // a restarted writer counts from 0 again 
+    if (head < next){
+      next = head; 
+    }
+    if (head - next > METRICS_RING_SIZE){
+      next = head - METRICS_RING_SIZE; 
+    }
+    for (; next < head; ++next){
+      if (metrics->read(next, sample)){
+        printSample(sample); 
+      }
+    }
+    this_thread::sleep_for(chrono::milliseconds(200)); 
+  }
+}